@@ -0,0 +1,216 @@
+r"""
+Benchmark: end-to-end counts over standard pattern and target families, for every backend.
+
+Every pattern family (paths, cycles, a grid, `K_{a,b}`, the Petersen graph,
+random graphs of treewidth `k`) is counted in every target family (`G(n, p)`
+at several densities, a grid, a complete graph, power-law Barabási–Albert
+graphs), with every backend: the standard counter, the Dask path with
+threads, and the work-stealing scheduler. All random graphs come from
+seeded generators, so runs are reproducible and offline. Pairs predicted to
+take more than ``--max-operations`` (see ``explain()``) are skipped.
+
+For every pair and backend, the best wall-clock time of ``--repeats`` runs
+(after a warm-up run) is recorded, then the peak of the memory traced by
+``tracemalloc`` (numpy tables included) during one more run, and the seconds
+per node type during a traced run (see `helpers/tracing.py`). All backends
+must give the same count.
+
+The results can be saved as JSON with ``--output``, and compared with a
+saved baseline with ``--baseline``: the ratio to the baseline time is shown
+next to every time, and ratios above ``--threshold`` are flagged (and fail
+the run with ``--fail-on-regression``).
+
+Run from the repository root::
+
+    sage -python benchmarks/end_to_end.py --output baseline.json
+    sage -python benchmarks/end_to_end.py --baseline baseline.json --filter 'grid|petersen'
+"""
+import argparse
+import json
+import os
+import platform
+import random
+import re
+import sys
+import time
+import tracemalloc
+
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+from sage.all import Graph, graphs
+
+from helpers.explain import estimate_count
+from helpers.tracing import Trace
+from parallel_hom_count import ParallelGraphHomomorphismCounter
+from standard_hom_count import GraphHomomorphismCounter
+
+
+def random_partial_ktree(num_vertices, k, edge_probability=0.7, seed=0):
+    r"""
+    Return a random graph of treewidth at most ``k``: a random `k`-tree keeping each edge with probability ``edge_probability``.
+    """
+    rng = random.Random(seed)
+    cliques = [tuple(range(k + 1))]
+    edges = {(u, v) for u in range(k + 1) for v in range(u + 1, k + 1)}
+    for vertex in range(k + 1, num_vertices):
+        clique = rng.choice(cliques)
+        attached = rng.sample(clique, k)
+        edges.update((u, vertex) for u in attached)
+        cliques.append(tuple(attached) + (vertex,))
+
+    graph = Graph([(u, v) for u, v in sorted(edges) if rng.random() < edge_probability])
+    graph.add_vertices(range(num_vertices))
+    return graph
+
+def grid(rows, columns):
+    graph = graphs.Grid2dGraph(rows, columns)
+    graph.relabel()
+    return graph
+
+PATTERNS = {
+    'P5': lambda: graphs.PathGraph(5),
+    'P8': lambda: graphs.PathGraph(8),
+    'C4': lambda: graphs.CycleGraph(4),
+    'C7': lambda: graphs.CycleGraph(7),
+    'grid3x3': lambda: grid(3, 3),
+    'K2,3': lambda: graphs.CompleteBipartiteGraph(2, 3),
+    'petersen': lambda: graphs.PetersenGraph(),
+    'tw2_n10': lambda: random_partial_ktree(10, 2, seed=1),
+    'tw3_n9': lambda: random_partial_ktree(9, 3, seed=2),
+}
+
+TARGETS = {
+    'gnp80_0.05': lambda: graphs.RandomGNP(80, 0.05, seed=1),
+    'gnp60_0.2': lambda: graphs.RandomGNP(60, 0.2, seed=2),
+    'gnp30_0.5': lambda: graphs.RandomGNP(30, 0.5, seed=3),
+    'grid10x10': lambda: grid(10, 10),
+    'K12': lambda: graphs.CompleteGraph(12),
+    'powerlaw150_m2': lambda: graphs.RandomBarabasiAlbert(150, 2, seed=4),
+}
+
+BACKENDS = {
+    'standard': lambda pattern, target, trace=None:
+        GraphHomomorphismCounter(pattern, target).count_homomorphisms(trace=trace),
+    'dask': lambda pattern, target, trace=None:
+        int(ParallelGraphHomomorphismCounter(pattern, target).count_homomorphisms_parallel(trace=trace)
+            .compute(scheduler='threads')[0]),
+    'work_stealing': lambda pattern, target, trace=None:
+        int(ParallelGraphHomomorphismCounter(pattern, target).count_homomorphisms_work_stealing()[0]),
+}
+
+# Backends recording per-node traces
+TRACED_BACKENDS = ('standard', 'dask')
+
+
+def run_case(pattern, target, backend, repeats):
+    r"""
+    Return the measurements of the count of ``pattern`` in ``target`` with ``backend``, as a dictionary.
+    """
+    run = BACKENDS[backend]
+    count = run(pattern, target)
+
+    seconds = []
+    for _ in range(repeats):
+        start = time.perf_counter()
+        if run(pattern, target) != count:
+            raise AssertionError(f"{backend}: results differ between runs")
+        seconds.append(time.perf_counter() - start)
+
+    tracemalloc.start()
+    run(pattern, target)
+    peak_bytes = tracemalloc.get_traced_memory()[1]
+    tracemalloc.stop()
+
+    node_seconds = None
+    if backend in TRACED_BACKENDS:
+        trace = Trace()
+        run(pattern, target, trace)
+        node_seconds = {row['type']: row['seconds'] for row in trace.summary()}
+
+    return {'count': count, 'seconds': min(seconds), 'peak_bytes': peak_bytes, 'node_seconds': node_seconds}
+
+def run_suite(backends, repeats, max_operations, name_filter=None, log=print):
+    r"""
+    Run every pair of families matching ``name_filter`` with every backend, and return the results by pair.
+    """
+    results = {}
+    for pattern_name, make_pattern in PATTERNS.items():
+        pattern = make_pattern()
+        for target_name, make_target in TARGETS.items():
+            case = f"{pattern_name}->{target_name}"
+            if name_filter is not None and not re.search(name_filter, case):
+                continue
+
+            target = make_target()
+            operations = estimate_count(ParallelGraphHomomorphismCounter(pattern, target)).operations
+            if operations > max_operations:
+                log(f"{case:<28} skipped, {operations:.2g} operations predicted")
+                continue
+
+            results[case] = {backend: run_case(pattern, target, backend, repeats) for backend in backends}
+            counts = {measurements['count'] for measurements in results[case].values()}
+            if len(counts) > 1:
+                raise AssertionError(f"{case}: backends disagree, {results[case]}")
+            log(format_row(case, results[case]))
+    return results
+
+def format_row(case, measurements, baseline=None, threshold=None):
+    cells = []
+    for backend, result in measurements.items():
+        cell = f"{result['seconds'] * 1000:9.2f} ms {result['peak_bytes'] / 2**20:7.1f} MiB"
+        reference = (baseline or {}).get(case, {}).get(backend)
+        if reference is not None:
+            ratio = result['seconds'] / reference['seconds']
+            cell += f" {ratio:5.2f}x" + ("!" if ratio > threshold else " ")
+        cells.append(cell)
+    return f"{case:<28} " + " | ".join(cells)
+
+def regressions(results, baseline, threshold):
+    r"""
+    Return the ``(case, backend, ratio)`` of the times more than ``threshold`` times their baseline.
+    """
+    return [(case, backend, result['seconds'] / baseline[case][backend]['seconds'])
+            for case, measurements in results.items() for backend, result in measurements.items()
+            if backend in baseline.get(case, {})
+            and result['seconds'] > threshold * baseline[case][backend]['seconds']]
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0].strip())
+    parser.add_argument('--backends', nargs='+', choices=list(BACKENDS), default=list(BACKENDS))
+    parser.add_argument('--repeats', type=int, default=3, help="timed runs per count, the best is kept")
+    parser.add_argument('--filter', help="only run the pairs 'pattern->target' matching this regular expression")
+    parser.add_argument('--max-operations', type=float, default=2e8,
+                        help="skip pairs predicted to need more operations")
+    parser.add_argument('--output', help="save the results to this JSON file")
+    parser.add_argument('--baseline', help="compare with the results saved in this JSON file")
+    parser.add_argument('--threshold', type=float, default=1.25, help="flag times above this ratio to the baseline")
+    parser.add_argument('--fail-on-regression', action='store_true')
+    args = parser.parse_args(argv)
+
+    print(f"{'pattern->target':<28} " + " | ".join(f"{backend:^{30 if args.baseline else 23}}"
+                                                   for backend in args.backends))
+    results = run_suite(args.backends, args.repeats, args.max_operations, args.filter,
+                        log=lambda line: None if args.baseline else print(line))
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)['cases']
+        for case, measurements in results.items():
+            print(format_row(case, measurements, baseline, args.threshold))
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump({'host': platform.node(), 'cpu_count': os.cpu_count(), 'created': time.time(),
+                       'repeats': args.repeats, 'cases': results}, f, indent=1)
+
+    if args.baseline:
+        slower = regressions(results, baseline, args.threshold)
+        for case, backend, ratio in slower:
+            print(f"regression: {case} with {backend}, {ratio:.2f}x the baseline")
+        if slower and args.fail_on_regression:
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,69 @@
+r"""
+Benchmark: scaling of the intra-node parallel kernels on chain-shaped decompositions.
+
+A path pattern has a nice tree decomposition without join nodes, so Dask
+finds no parallelism between subtrees and all speedup comes from the chunked
+`prange` loops inside the intro and forget kernels. The count is run with
+Dask's synchronous scheduler for 1, 2, 4, ..., 64 Numba threads (capped at
+the cores available), and every thread count must give the same result.
+
+The kernels only run on int64 tables, i.e. when ``target_size ** path_length``
+is below ``2**63``: the default P5 on GNP(2000, 0.01) is; P8 needs a target of
+about 200 vertices.
+
+Run from the repository root::
+
+    sage -python benchmarks/intra_node_scaling.py [path_length] [target_size]
+"""
+import os
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+import numba
+from sage.all import graphs
+
+from parallel_hom_count import ParallelGraphHomomorphismCounter
+
+
+def main(path_length=5, target_size=2000):
+    pattern = graphs.PathGraph(path_length)
+    target = graphs.RandomGNP(target_size, 0.01, seed=42)
+
+    counter = ParallelGraphHomomorphismCounter(pattern, target)
+    assert counter.int64_tables, (f"{target_size}**{path_length} >= 2**63: the tables hold exact integers, "
+                                  f"and the threaded kernels would never run")
+    num_joins = sum(1 for node in counter.dir_labelled_TD if counter.dir_labelled_TD.get_vertex(node) == 'join')
+    largest_table = target_size ** max(len(bag) for _, bag in counter.dir_labelled_TD)
+
+    print(f"P{path_length} -> GNP({target_size}, 0.01): {len(counter.dir_labelled_TD)} nodes, "
+          f"{num_joins} join nodes, largest table {largest_table} entries")
+    print(f"{'threads':>8} {'seconds':>9} {'speedup':>8} {'efficiency':>10}")
+
+    # Compile and load everything outside of the timings
+    counter.count_homomorphisms_parallel().compute(scheduler='synchronous')
+
+    thread_counts = [t for t in (1, 2, 4, 8, 16, 32, 64) if t <= numba.config.NUMBA_NUM_THREADS]
+    reference = baseline = None
+
+    for threads in thread_counts:
+        numba.set_num_threads(threads)
+
+        start = time.perf_counter()
+        result = counter.count_homomorphisms_parallel().compute(scheduler='synchronous')
+        seconds = time.perf_counter() - start
+
+        if reference is None:
+            reference, baseline = list(result), seconds
+        elif list(result) != reference:
+            raise AssertionError(f"{threads} threads gave {list(result)}, expected {reference}")
+
+        speedup = baseline / seconds
+        print(f"{threads:>8} {seconds:>9.3f} {speedup:>8.2f} {speedup / threads:>10.0%}")
+
+    print(f"Result {reference[0]} identical for all thread counts")
+
+
+if __name__ == "__main__":
+    main(*map(int, sys.argv[1:]))
@@ -0,0 +1,227 @@
+r"""
+Benchmark: throughput of every node kernel, against the memory bandwidth of the host.
+
+Each node type is timed in isolation, over a sweep of target sizes, bag
+sizes and target densities, with every implementation of the engines:
+
+- ``standard``: ``GraphHomomorphismCounter._add_intro_node_best``,
+  ``_add_forget_node_best`` and ``_add_join_node_best`` with int64 tables (the
+  compiled kernels, skipped if they are not built);
+- ``standard-exact``: the same methods with lists of exact integers (the
+  pure-Python loops);
+- ``parallel``: ``run_task_spec`` of the parallel engine on a one-node
+  program with int64 tables (the Numba kernels);
+- ``parallel-exact``: the same with tables of exact integers (array broadcasting).
+
+The child tables are random counts below 10, so that nothing overflows. The
+intro nodes are those of a clique pattern, whose intro vertex is adjacent to
+the whole child bag; the join node has the bag of the largest one. Forget and
+join nodes do not read the target, so they are only timed at the first density.
+
+A node of bag size `k` over a target of `n` vertices handles ``entries`` `= n^k`
+entries, and moves the int64 bytes of its tables: its child of `n^{k-1}`
+entries and its table of `n^k` for an intro node, the reverse for a forget
+node, and three tables of `n^k` for a join node. Tables of exact integers are
+reported with the same nominal bytes. ``GB/s`` divides these bytes by the best
+time of a node, and ``% bw`` compares it with the bandwidth of a large numpy
+copy (bytes read and written) measured at the start: the kernel with the
+lowest ``% bw`` is the furthest from the hardware limit.
+Tables that fit in the caches can go above 100%.
+
+Run from the repository root::
+
+    sage -python benchmarks/kernel_throughput.py
+    sage -python benchmarks/kernel_throughput.py --sizes 64 256 --bags 2 3 --densities 0.1 --output kernels.json
+"""
+import argparse
+import json
+import os
+import platform
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+import numpy as np
+from sage.all import DiGraph, graphs
+
+from helpers.dp_kernels import HAVE_COMPILED_KERNELS
+from helpers.task_specs import TaskSpec, run_task_spec
+from parallel_hom_count import ParallelGraphHomomorphismCounter
+from standard_hom_count import GraphHomomorphismCounter
+
+
+NODE_TYPES = ('intro', 'forget', 'join')
+BACKENDS = ('standard', 'standard-exact', 'parallel', 'parallel-exact')
+
+
+def best_time(function, min_seconds):
+    r"""
+    Return the best time of a call of ``function``, after a warm-up call, repeating it for about ``min_seconds``.
+    """
+    function()
+    best = float('inf')
+    deadline = time.perf_counter() + min_seconds
+    while True:
+        start = time.perf_counter()
+        function()
+        end = time.perf_counter()
+        best = min(best, end - start)
+        if end >= deadline:
+            return best
+
+def copy_bandwidth(num_bytes, min_seconds=0.5):
+    r"""
+    Return the bandwidth of a numpy copy between two arrays of ``num_bytes`` bytes, in bytes read and written per second.
+    """
+    source = np.ones(num_bytes // 8, dtype=np.int64)
+    destination = np.empty_like(source)
+    return 2 * source.nbytes / best_time(lambda: np.copyto(destination, source), min_seconds)
+
+def moved_bytes(node_type, n, bag_size):
+    match node_type:
+        case 'intro' | 'forget':
+            return 8 * (n ** bag_size + n ** (bag_size - 1))
+        case 'join':
+            return 8 * 3 * n ** bag_size
+
+
+def kernel_node(counter, node_type, bag_size):
+    r"""
+    Return a node of ``counter`` of type ``node_type`` whose largest table has bag size ``bag_size``, and its children.
+
+    The decomposition of ``counter`` is replaced by a three-node one for a join node.
+    """
+    decomposition = counter.dir_labelled_TD
+    intro = next(node for node in decomposition
+                 if decomposition.get_vertex(node) == 'intro' and len(node[1]) == bag_size)
+
+    match node_type:
+        case 'intro':
+            return intro, decomposition.neighbors_out(intro)
+        case 'forget':
+            forget = next(node for node in decomposition if decomposition.get_vertex(node) == 'forget'
+                          and len(decomposition.neighbors_out(node)[0][1]) == bag_size)
+            return forget, decomposition.neighbors_out(forget)
+        case 'join':
+            join, left, right = [(index, intro[1]) for index in range(3)]
+            counter.dir_labelled_TD = DiGraph([(join, left), (join, right)])
+            counter.dir_labelled_TD.set_vertex(join, 'join')
+            return join, [left, right]
+
+def standard_kernel(pattern, target, node_type, bag_size, rng, exact):
+    r"""
+    Return a function computing a node with the standard engine.
+    """
+    counter = GraphHomomorphismCounter(pattern, target)
+    node, children = kernel_node(counter, node_type, bag_size)
+    for child in children:
+        table = rng.integers(0, 10, counter.actual_target_size ** len(child[1]), dtype=np.int64)
+        counter.DP_table[child[0]] = table.tolist() if exact else table
+
+    match node_type:
+        case 'intro':
+            return lambda: counter._add_intro_node_best(node)
+        case 'forget':
+            return lambda: counter._add_forget_node_best(node)
+        case 'join':
+            return lambda: counter._add_join_node_best(node)
+
+def parallel_kernel(pattern, target, node_type, bag_size, rng, exact):
+    r"""
+    Return a function computing a node with the task interpreter of the parallel engine.
+    """
+    counter = ParallelGraphHomomorphismCounter(pattern, target)
+    node, children = kernel_node(counter, node_type, bag_size)
+    tables = [rng.integers(0, 10, counter.actual_target_size ** len(child[1]), dtype=np.int64) for child in children]
+    if exact:
+        tables = [table.astype(object) for table in tables]
+
+    instruction = ('join',) if node_type == 'join' else counter._node_instruction(node)
+    program = tuple(('input', index) for index in range(len(tables))) + (instruction,)
+    spec = TaskSpec(program, counter.shared_target, 'object' if exact else 'int64')
+    return lambda: run_task_spec(spec, *tables)
+
+KERNELS = {
+    'standard': lambda *args: standard_kernel(*args, exact=False),
+    'standard-exact': lambda *args: standard_kernel(*args, exact=True),
+    'parallel': lambda *args: parallel_kernel(*args, exact=False),
+    'parallel-exact': lambda *args: parallel_kernel(*args, exact=True),
+}
+
+
+def run_sweep(sizes, bag_sizes, densities, backends, bandwidth, max_entries, exact_max_entries, min_seconds,
+              log=print):
+    r"""
+    Time every kernel of the sweep, and return a list of dictionaries, one per measurement.
+    """
+    rng = np.random.default_rng(0)
+    results = []
+    for bag_size in bag_sizes:
+        pattern = graphs.CompleteGraph(bag_size)
+        for n in sizes:
+            entries = n ** bag_size
+            for density_index, density in enumerate(densities):
+                target = graphs.RandomGNP(n, density, seed=density_index)
+                for node_type in NODE_TYPES:
+                    if node_type != 'intro' and density_index > 0:
+                        continue
+                    for backend in backends:
+                        limit = exact_max_entries if backend.endswith('exact') else max_entries
+                        if entries > limit or (backend == 'standard' and not HAVE_COMPILED_KERNELS):
+                            continue
+
+                        seconds = best_time(KERNELS[backend](pattern, target, node_type, bag_size, rng), min_seconds)
+                        bytes_per_second = moved_bytes(node_type, n, bag_size) / seconds
+                        result = {'kernel': node_type, 'backend': backend, 'target_size': n, 'bag_size': bag_size,
+                                  'density': density, 'entries': entries, 'seconds': seconds,
+                                  'entries_per_second': entries / seconds, 'bytes_per_second': bytes_per_second,
+                                  'bandwidth_fraction': bytes_per_second / bandwidth}
+                        results.append(result)
+                        log(format_result(result))
+    return results
+
+def format_result(result):
+    return (f"{result['kernel']:<7}{result['backend']:<16}{result['target_size']:>6}{result['bag_size']:>5}"
+            f"{result['density']:>9.2f}{result['entries']:>13}{result['seconds'] * 1000:>11.3f}"
+            f"{result['entries_per_second'] / 1e6:>12.1f}{result['bytes_per_second'] / 1e9:>9.2f}"
+            f"{result['bandwidth_fraction']:>8.1%}")
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0].strip())
+    parser.add_argument('--sizes', nargs='+', type=int, default=[32, 128, 512])
+    parser.add_argument('--bags', nargs='+', type=int, default=[2, 3, 4])
+    parser.add_argument('--densities', nargs='+', type=float, default=[0.05, 0.5])
+    parser.add_argument('--backends', nargs='+', choices=BACKENDS, default=list(BACKENDS))
+    parser.add_argument('--max-entries', type=int, default=1 << 24, help="largest table timed with int64 tables")
+    parser.add_argument('--exact-max-entries', type=int, default=1 << 16,
+                        help="largest table timed with exact integers")
+    parser.add_argument('--min-seconds', type=float, default=0.2, help="time spent per measurement")
+    parser.add_argument('--bandwidth-mib', type=int, default=256, help="size of the arrays of the copy baseline")
+    parser.add_argument('--output', help="save the results to this JSON file")
+    args = parser.parse_args(argv)
+
+    bandwidth = copy_bandwidth(args.bandwidth_mib << 20)
+    print(f"numpy copy of {args.bandwidth_mib} MiB: {bandwidth / 1e9:.2f} GB/s read and written")
+    print(f"{'kernel':<7}{'backend':<16}{'n':>6}{'bag':>5}{'density':>9}{'entries':>13}{'ms':>11}"
+          f"{'M entries/s':>12}{'GB/s':>9}{'% bw':>8}")
+    results = run_sweep(args.sizes, args.bags, args.densities, args.backends, bandwidth, args.max_entries,
+                        args.exact_max_entries, args.min_seconds)
+
+    print("Best fraction of the bandwidth, per kernel:")
+    for node_type in NODE_TYPES:
+        for backend in args.backends:
+            fractions = [result['bandwidth_fraction'] for result in results
+                         if result['kernel'] == node_type and result['backend'] == backend]
+            if fractions:
+                print(f"{node_type:<7}{backend:<16}{max(fractions):>8.1%}")
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump({'host': platform.node(), 'cpu_count': os.cpu_count(), 'created': time.time(),
+                       'copy_bytes_per_second': bandwidth, 'results': results}, f, indent=1)
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
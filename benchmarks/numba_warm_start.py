@@ -0,0 +1,78 @@
+r"""
+Benchmark: JIT compilation overhead of the parallel engine's Numba kernels.
+
+Compares, each in a fresh process,
+
+- the former per-call JIT, where every join node defined (and so compiled)
+  its own ``@jit`` function;
+- the module-level kernels of `helpers/numba_kernels.py` with an empty disk cache;
+- the same kernels with a warm disk cache, i.e. any run after the first.
+
+Run from the repository root (no Sage needed)::
+
+    python benchmarks/numba_warm_start.py
+"""
+import os
+import subprocess
+import sys
+import tempfile
+
+REPO_ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# Number of join nodes simulated in each process
+NUM_JOINS = 20
+
+PER_CALL_JIT = f"""
+import time
+import numpy as np
+from numba import jit
+
+def join(left, right):
+    @jit(nopython=True, parallel=True)
+    def multiply_elements(left, right):
+        return left * right
+    return multiply_elements(left, right)
+
+table = np.arange(1000, dtype=np.int64)
+start = time.perf_counter()
+for _ in range({NUM_JOINS}):
+    join(table, table)
+print(time.perf_counter() - start)
+"""
+
+MODULE_LEVEL = f"""
+import time
+start = time.perf_counter()
+
+import numpy as np
+from helpers.numba_kernels import join_table, warm_up
+
+warm_up()
+table = np.arange(1000, dtype=np.int64)
+for _ in range({NUM_JOINS}):
+    join_table(table, table)
+print(time.perf_counter() - start)
+"""
+
+
+def run(code, env):
+    output = subprocess.run([sys.executable, "-c", code], cwd=REPO_ROOT, env=env,
+                            capture_output=True, text=True, check=True).stdout
+    return float(output.split()[-1])
+
+def main():
+    with tempfile.TemporaryDirectory() as cache_dir:
+        env = dict(os.environ, NUMBA_CACHE_DIR=cache_dir)
+
+        per_call = run(PER_CALL_JIT, env)
+        cold = run(MODULE_LEVEL, env)
+        warm = run(MODULE_LEVEL, env)
+
+    print(f"{NUM_JOINS} join nodes, seconds spent in JIT + kernels:")
+    print(f"  per-call @jit (before)          {per_call:8.3f}")
+    print(f"  module-level kernels, cold cache {cold:8.3f}  (includes compiling all kernels)")
+    print(f"  module-level kernels, warm cache {warm:8.3f}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,67 @@
+r"""
+Benchmark: the built-in work-stealing scheduler against the Dask path.
+
+Uses the tutorial's example, the 3x3 grid into `RandomGNP(20, 0.5)`, a
+mid-sized count where scheduling overhead matters. Each engine runs the
+count ``repeats`` times after a warm-up run (Numba compilation, target
+loading), and the best wall-clock time is reported. Every run must give the
+same number of homomorphisms.
+
+Run from the repository root::
+
+    sage -python benchmarks/work_stealing_vs_dask.py [repeats]
+"""
+import os
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+from sage.all import graphs
+
+from parallel_hom_count import ParallelGraphHomomorphismCounter
+
+
+def best_time(run, repeats):
+    result = run()
+    seconds = []
+    for _ in range(repeats):
+        start = time.perf_counter()
+        if run()[0] != result[0]:
+            raise AssertionError("results differ between runs")
+        seconds.append(time.perf_counter() - start)
+    return min(seconds), int(result[0])
+
+def main(repeats=5):
+    three_grid = graphs.Grid2dGraph(3, 3)
+    three_grid.relabel()
+    random_graph = graphs.RandomGNP(20, 0.5, seed=42)
+
+    counter = ParallelGraphHomomorphismCounter(three_grid, random_graph)
+    cores = os.cpu_count()
+
+    engines = [
+        ("dask, threads, fused tasks", lambda: counter.count_homomorphisms_parallel().compute(scheduler='threads')),
+        ("dask, threads, one task per join child",
+         lambda: counter.count_homomorphisms_parallel(fusion_threshold=0).compute(scheduler='threads')),
+        ("work stealing, 1 worker", lambda: counter.count_homomorphisms_work_stealing(num_workers=1)),
+    ]
+    if cores > 1:
+        engines.append((f"work stealing, {cores} workers",
+                        lambda: counter.count_homomorphisms_work_stealing(num_workers=cores)))
+
+    print(f"three_grid -> RandomGNP(20, 0.5): {len(counter.dir_labelled_TD)} nodes, best of {repeats}")
+    reference = None
+    for name, run in engines:
+        seconds, result = best_time(run, repeats)
+        if reference is None:
+            reference = result
+        elif result != reference:
+            raise AssertionError(f"{name} gave {result}, expected {reference}")
+        print(f"  {name:<40} {seconds * 1000:9.2f} ms")
+
+    print(f"Result {reference} identical for all engines")
+
+
+if __name__ == "__main__":
+    main(*map(int, sys.argv[1:]))
@@ -0,0 +1,307 @@
+r"""
+A long-lived counting daemon, answering requests over a Unix domain socket.
+
+Starting Sage and building a counter costs seconds, mostly spent importing
+and computing tree decompositions. The daemon pays it once: it keeps parsed
+and converted targets (see ``ConvertedTarget`` in `helpers/prepared_target.py`),
+pattern plans (see `helpers/plan.py`) and results in memory, and answers
+requests in milliseconds.
+
+Start it with::
+
+    sage -python count_daemon.py --socket /tmp/hom-count.sock
+
+The protocol is one JSON object per line, each answered by one JSON object
+per line, in completion order; a request ``"id"`` is echoed in its answer.
+Graphs are given as ``{"graph6": "..."}`` (graph6 or sparse6), or by the name
+of a registered graph, ``{"name": "..."}``:
+
+- ``{"op": "register", "name": "petersen", "graph6": "IheA@GUAo"}`` registers a graph;
+- ``{"op": "count", "pattern": {...}, "target": {...}}`` counts homomorphisms,
+  with the optional fields ``"graph_clr"``, ``"target_clr"`` and ``"colourful"``
+  of the counters, and ``"engine"``: ``"standard"`` (default) or ``"work_stealing"``;
+- ``{"op": "stats"}`` returns the sizes of the caches.
+
+Count requests arriving within ``batch_window`` seconds of each other are
+batched: requests for the same count are computed once, and the others run
+grouped by pattern, then by target. Every answer has a ``"timing"`` field
+(milliseconds queued, preparing the pattern and target, counting, in total;
+the batch size; and which caches were hit).
+
+From Python, :func:`send_request` sends a request and returns the answer.
+"""
+import argparse
+import asyncio
+import json
+import socket
+import sys
+import time
+from collections import OrderedDict
+
+from helpers.graph_io import parse_graph6
+from helpers.plan import PatternPlan
+from helpers.prepared_target import ConvertedTarget
+from standard_hom_count import GraphHomomorphismCounter
+from parallel_hom_count import ParallelGraphHomomorphismCounter
+
+
+# Count requests arriving within this many seconds are batched together
+BATCH_WINDOW = 0.005
+MAX_BATCH = 256
+
+# Number of plans, targets and results kept in memory
+CACHE_SIZE = 1024
+RESULT_CACHE_SIZE = 1 << 16
+
+ENGINES = ('standard', 'work_stealing')
+
+
+class LRUCache:
+    r"""
+    A mapping keeping the ``maxsize`` most recently used entries.
+    """
+    def __init__(self, maxsize):
+        self.maxsize = maxsize
+        self.entries = OrderedDict()
+
+    def __len__(self):
+        return len(self.entries)
+
+    def get(self, key):
+        if key not in self.entries:
+            return None
+        self.entries.move_to_end(key)
+        return self.entries[key]
+
+    def put(self, key, value):
+        self.entries[key] = value
+        self.entries.move_to_end(key)
+        if len(self.entries) > self.maxsize:
+            self.entries.popitem(last=False)
+
+
+class CountingDaemon:
+    r"""
+    The state of the daemon: registered graphs, warm caches and the batch queue.
+
+    INPUT:
+
+    - ``batch_window`` (default: ``BATCH_WINDOW``) -- how long, in seconds, a
+      batch waits for more count requests after its first one
+
+    - ``max_batch`` (default: ``MAX_BATCH``) -- the maximum number of requests per batch
+
+    - ``cache_size`` (default: ``CACHE_SIZE``) -- the number of pattern plans,
+      and of targets, kept in memory
+
+    - ``result_cache_size`` (default: ``RESULT_CACHE_SIZE``) -- the number of results kept in memory
+    """
+    def __init__(self, batch_window=BATCH_WINDOW, max_batch=MAX_BATCH, cache_size=CACHE_SIZE,
+                 result_cache_size=RESULT_CACHE_SIZE):
+        self.batch_window = batch_window
+        self.max_batch = max_batch
+        self.registered = {}
+        self.plans = LRUCache(cache_size)
+        self.targets = LRUCache(cache_size)
+        self.results = LRUCache(result_cache_size)
+        self.queue = None
+
+    async def serve(self, socket_path):
+        r"""
+        Answer requests on the Unix domain socket ``socket_path`` until cancelled.
+        """
+        self.queue = asyncio.Queue()
+        batcher = asyncio.create_task(self._batch_loop())
+        server = await asyncio.start_unix_server(self._serve_connection, path=socket_path)
+        try:
+            async with server:
+                await server.serve_forever()
+        finally:
+            batcher.cancel()
+
+    async def answer(self, request):
+        r"""
+        Return the answer to the request ``request``, a dictionary.
+        """
+        answer = {}
+        try:
+            if not isinstance(request, dict):
+                raise ValueError("a request must be a JSON object")
+            if 'id' in request:
+                answer['id'] = request['id']
+            match request.get('op'):
+                case 'register':
+                    self.registered[request['name']] = request['graph6'].strip()
+                    answer['registered'] = request['name']
+                case 'count':
+                    future = asyncio.get_running_loop().create_future()
+                    await self.queue.put((self._parse_count(request), time.perf_counter(), future))
+                    answer.update(await future)
+                case 'stats':
+                    answer.update(registered=len(self.registered), plans=len(self.plans), targets=len(self.targets),
+                                  results=len(self.results))
+                case op:
+                    raise ValueError(f"unknown op {op!r}")
+        except Exception as error:
+            answer['error'] = f"{type(error).__name__}: {error}"
+        return answer
+
+    async def _serve_connection(self, reader, writer):
+        lock = asyncio.Lock()
+
+        async def answer_line(line):
+            try:
+                answer = await self.answer(json.loads(line))
+            except json.JSONDecodeError as error:
+                answer = {'error': f"JSONDecodeError: {error}"}
+            async with lock:
+                writer.write(json.dumps(answer).encode() + b"\n")
+                await writer.drain()
+
+        # Requests of one connection are answered concurrently, so they can be batched
+        pending = set()
+        try:
+            while line := await reader.readline():
+                if line.strip():
+                    task = asyncio.create_task(answer_line(line))
+                    pending.add(task)
+                    task.add_done_callback(pending.discard)
+            await asyncio.gather(*pending)
+        finally:
+            writer.close()
+
+    def _parse_count(self, request):
+        r"""
+        Return the cache key of the count asked by ``request``.
+        """
+        engine = request.get('engine', 'standard')
+        if engine not in ENGINES:
+            raise ValueError(f"engine must be one of {ENGINES}")
+
+        colourful = bool(request.get('colourful', False))
+        graph_clr = tuple(request['graph_clr']) if colourful else None
+        target_clr = tuple(request['target_clr']) if colourful else None
+
+        return (self._graph6(request['pattern']), self._graph6(request['target']),
+                colourful, graph_clr, target_clr, engine)
+
+    def _graph6(self, reference):
+        if 'graph6' in reference:
+            return reference['graph6'].strip()
+        if reference.get('name') in self.registered:
+            return self.registered[reference['name']]
+        raise KeyError(f"unknown graph {reference!r}")
+
+    async def _batch_loop(self):
+        loop = asyncio.get_running_loop()
+        while True:
+            batch = [await self.queue.get()]
+            deadline = loop.time() + self.batch_window
+            while len(batch) < self.max_batch:
+                try:
+                    batch.append(await asyncio.wait_for(self.queue.get(), max(0, deadline - loop.time())))
+                except asyncio.TimeoutError:
+                    break
+
+            try:
+                answers = await loop.run_in_executor(None, self._run_batch, batch)
+            except Exception as error:
+                answers = [{'error': f"{type(error).__name__}: {error}"}] * len(batch)
+
+            for (_, _, future), answer in zip(batch, answers):
+                if not future.done():
+                    future.set_result(answer)
+
+    def _run_batch(self, batch):
+        r"""
+        Return the answers to the count requests of ``batch``, computing each distinct count once.
+        """
+        batch_start = time.perf_counter()
+        computed = {}
+
+        # Same pattern, then same target, one after the other
+        for key in sorted({key for key, _, _ in batch}):
+            try:
+                computed[key] = self._count(key)
+            except Exception as error:
+                computed[key] = {'error': f"{type(error).__name__}: {error}"}
+
+        answers = []
+        for key, arrival, _ in batch:
+            answer = dict(computed[key])
+            if 'timing' in answer:
+                answer['timing'] = dict(answer['timing'], queued_ms=(batch_start - arrival) * 1000,
+                                        total_ms=(time.perf_counter() - arrival) * 1000, batch_size=len(batch))
+            answers.append(answer)
+        return answers
+
+    def _count(self, key):
+        pattern, target, colourful, graph_clr, target_clr, engine = key
+        timing = {}
+
+        result = self.results.get(key)
+        timing['result_cached'] = result is not None
+        if result is None:
+            start = time.perf_counter()
+            plan = self.plans.get(pattern)
+            timing['plan_cached'] = plan is not None
+            if plan is None:
+                plan = PatternPlan(parse_graph6(pattern).to_sage_graph())
+                self.plans.put(pattern, plan)
+
+            # The conversions of the target for the standard engine are kept with it
+            converted = self.targets.get(target)
+            timing['target_cached'] = converted is not None
+            if converted is None:
+                converted = ConvertedTarget(parse_graph6(target))
+                self.targets.put(target, converted)
+            prepared_target = converted.target_graph
+            timing['prepare_ms'] = (time.perf_counter() - start) * 1000
+
+            start = time.perf_counter()
+            options = dict(graph_clr=graph_clr and list(graph_clr), target_clr=target_clr and list(target_clr),
+                           colourful=colourful, plan=plan)
+            if engine == 'standard':
+                result = GraphHomomorphismCounter(plan.graph, prepared_target, converted=converted,
+                                                  **options).count_homomorphisms()
+            else:
+                counter = ParallelGraphHomomorphismCounter(plan.graph, prepared_target, **options)
+                result = int(counter.count_homomorphisms_work_stealing()[0])
+            timing['count_ms'] = (time.perf_counter() - start) * 1000
+            self.results.put(key, result)
+
+        return {'count': result, 'timing': timing}
+
+
+def send_request(socket_path, request):
+    r"""
+    Send ``request`` (a dictionary) to the daemon listening on ``socket_path``, and return its answer.
+    """
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as connection:
+        connection.connect(socket_path)
+        connection.sendall(json.dumps(request).encode() + b"\n")
+        with connection.makefile('rb') as answers:
+            return json.loads(answers.readline())
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0].strip())
+    parser.add_argument('--socket', required=True, help="path of the Unix domain socket")
+    parser.add_argument('--batch-window', type=float, default=BATCH_WINDOW,
+                        help="seconds a batch waits for more count requests")
+    parser.add_argument('--request', help="send this JSON request to a running daemon and print its answer")
+    args = parser.parse_args(argv)
+
+    if args.request is not None:
+        print(json.dumps(send_request(args.socket, json.loads(args.request))))
+        return
+
+    daemon = CountingDaemon(batch_window=args.batch_window)
+    try:
+        asyncio.run(daemon.serve(args.socket))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
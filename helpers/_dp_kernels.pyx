@@ -0,0 +1,175 @@
+# cython: language_level=3, boundscheck=False, wraparound=False, cdivision=True, initializedcheck=False
+r"""
+Compiled intro, forget and join kernels over the integer (mixed-radix) representation.
+
+A DP table over a bag of size `k` is an int64 array of length `n^k`, where the
+mapping `\varphi` of the bag vertices `b_0, ..., b_{k-1}` is stored at index
+`\sum_i \varphi(b_i) n^i`, as in `helpers/help_functions.py`.
+
+Inserting (or removing) the digit at position `p` splits an index into a *low*
+part (positions below `p`, `n^p` values) and a *high* part (positions above `p`).
+All kernels loop over `(high, digit)` pairs in parallel with OpenMP, and over the
+low part in an innermost contiguous loop that the compiler can vectorise.
+
+Entries are stored in 64 bits. Sums and products are formed in 128 bits, and the
+kernels raise ``OverflowError`` when a result does not fit in 64 bits, so that
+the caller can fall back to exact Python integers.
+
+Build with ``python setup.py build_ext --inplace`` from the repository root.
+"""
+from cython.parallel cimport parallel, prange
+from libc.stdint cimport int64_t, uint8_t, INT64_MAX, INT64_MIN
+from libc.stdlib cimport malloc, free
+
+import numpy as np
+
+cdef extern from *:
+    ctypedef long long int128_t "__int128"
+
+cdef enum:
+    # Number of low entries summed per task in `forget_kernel`
+    FORGET_BLOCK = 1024
+
+
+cdef Py_ssize_t _checked_power(n, exponent) except -1:
+    power = int(n) ** int(exponent)
+    if power > 2 ** 62:
+        raise OverflowError("DP table too large")
+    return power
+
+cdef object _digit_powers(n, positions):
+    return np.array([int(n) ** position for position in positions], dtype=np.intp)
+
+
+def intro_kernel(const int64_t[::1] child, Py_ssize_t n, Py_ssize_t intro_index,
+                 nbr_positions, const uint8_t[:, ::1] adjacency, const uint8_t[::1] allowed):
+    r"""
+    Return the DP table of an intro node.
+
+    INPUT:
+
+    - ``child`` -- the DP table of the child node
+
+    - ``n`` -- the size of the target graph
+
+    - ``intro_index`` -- the position of the intro vertex in the bag
+
+    - ``nbr_positions`` -- the positions, in the child bag, of the neighbours of
+      the intro vertex
+
+    - ``adjacency`` -- the `n \times n` adjacency matrix of the target, as uint8
+
+    - ``allowed`` -- for each target vertex, whether the intro vertex may be
+      mapped to it (e.g. it has the right colour), as uint8
+    """
+    cdef Py_ssize_t low = _checked_power(n, intro_index)
+    cdef Py_ssize_t high = child.shape[0] // low
+    if int(low) * n * high > 2 ** 62:
+        raise OverflowError("DP table too large")
+
+    low_positions = [q for q in nbr_positions if q < intro_index]
+    high_positions = [q - intro_index for q in nbr_positions if q >= intro_index]
+    cdef Py_ssize_t[::1] low_powers = _digit_powers(n, low_positions)
+    cdef Py_ssize_t[::1] high_powers = _digit_powers(n, high_positions)
+    cdef Py_ssize_t num_low = low_powers.shape[0], num_high = high_powers.shape[0]
+
+    out = np.zeros(low * n * high, dtype=np.int64)
+    low_valid_array = np.empty(n * low, dtype=np.uint8)
+    cdef int64_t[::1] out_view = out
+    cdef uint8_t[::1] low_valid = low_valid_array
+
+    cdef Py_ssize_t x, lo, t, hi, q, base
+    cdef uint8_t valid
+
+    with nogil:
+        # Validity of `x` against the neighbours among the low digits
+        for x in prange(n, schedule='static'):
+            for lo in range(low):
+                valid = allowed[x]
+                for q in range(num_low):
+                    valid = valid & adjacency[x, (lo // low_powers[q]) % n]
+                low_valid[x * low + lo] = valid
+
+        # Output block `t = hi * n + x` holds the `low` mappings sending the intro vertex to `x`
+        for t in prange(high * n, schedule='static'):
+            hi = t // n
+            x = t % n
+
+            valid = 1
+            for q in range(num_high):
+                valid = valid & adjacency[x, (hi // high_powers[q]) % n]
+
+            if valid:
+                base = hi * low
+                for lo in range(low):
+                    out_view[t * low + lo] = child[base + lo] * low_valid[x * low + lo]
+
+    return out
+
+
+def forget_kernel(const int64_t[::1] child, Py_ssize_t n, Py_ssize_t forgotten_index):
+    r"""
+    Return the DP table of a forget node, summing ``child`` over the digit ``forgotten_index``.
+    """
+    cdef Py_ssize_t low = _checked_power(n, forgotten_index)
+    cdef Py_ssize_t high = child.shape[0] // (low * n)
+
+    out = np.empty(low * high, dtype=np.int64)
+    cdef int64_t[::1] out_view = out
+
+    cdef Py_ssize_t blocks_per_high = (low + FORGET_BLOCK - 1) // FORGET_BLOCK
+    cdef Py_ssize_t t, hi, start, stop, x, lo, base
+    cdef int128_t * acc = NULL
+    cdef int overflows = 0
+
+    with nogil, parallel():
+        acc = <int128_t *> malloc(FORGET_BLOCK * sizeof(int128_t))
+
+        for t in prange(high * blocks_per_high, schedule='static'):
+            hi = t // blocks_per_high
+            start = (t % blocks_per_high) * FORGET_BLOCK
+            stop = min(start + FORGET_BLOCK, low)
+
+            for lo in range(stop - start):
+                acc[lo] = 0
+
+            # Digits in increasing order, as in the Python loop
+            for x in range(n):
+                base = (hi * n + x) * low + start
+                for lo in range(stop - start):
+                    acc[lo] += child[base + lo]
+
+            for lo in range(stop - start):
+                if acc[lo] > INT64_MAX or acc[lo] < INT64_MIN:
+                    overflows += 1
+                out_view[hi * low + start + lo] = <int64_t> acc[lo]
+
+        free(acc)
+
+    if overflows:
+        raise OverflowError("forget node entries do not fit in 64 bits")
+    return out
+
+
+def join_kernel(const int64_t[::1] left, const int64_t[::1] right):
+    r"""
+    Return the entrywise product of the DP tables of the two children of a join node.
+    """
+    cdef Py_ssize_t length = left.shape[0], i
+    if right.shape[0] != length:
+        raise ValueError("children tables of a join node must have the same length")
+
+    out = np.empty(length, dtype=np.int64)
+    cdef int64_t[::1] out_view = out
+    cdef int128_t product
+    cdef int overflows = 0
+
+    for i in prange(length, nogil=True, schedule='static'):
+        product = <int128_t> left[i] * right[i]
+        if product > INT64_MAX or product < INT64_MIN:
+            overflows += 1
+        out_view[i] = <int64_t> product
+
+    if overflows:
+        raise OverflowError("join node entries do not fit in 64 bits")
+    return out
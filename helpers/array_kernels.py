@@ -0,0 +1,73 @@
+r"""
+Intro, forget and join on whole DP tables through array broadcasting.
+
+A flat DP table over a bag of size `k` (integer representation, see
+`helpers/help_functions.py`) reshaped to `(n,) * k` in C order has the digit of
+bag position `i` on axis `k - 1 - i`. Intro, forget and join then become a
+broadcast product with adjacency blocks, a sum over one axis and a product.
+
+The functions only use array methods and operators, and work with any integer
+dtype: int64 tables, object tables of exact Python integers, and `dask.array`
+tables alike.
+"""
+import numpy as np
+
+
+def digit_axis(bag_size, position):
+    r"""
+    Return the axis holding the digit of bag position ``position`` in a table over ``bag_size`` vertices.
+    """
+    return bag_size - 1 - position
+
+def intro_array(child, n, child_bag_size, intro_index, nbr_positions, adjacency, allowed):
+    r"""
+    Return the flat DP table of an intro node.
+
+    INPUT:
+
+    - ``child`` -- the flat DP table of the child, over ``child_bag_size`` vertices
+
+    - ``n`` -- the size of the target graph
+
+    - ``intro_index`` -- the position of the intro vertex in the bag
+
+    - ``nbr_positions`` -- the positions, in the child bag, of the neighbours of the intro vertex
+
+    - ``adjacency`` -- the (symmetric) `n \times n` adjacency matrix of the target
+
+    - ``allowed`` -- for each target vertex, whether the intro vertex may be mapped to it
+    """
+    bag_size = child_bag_size + 1
+    intro_axis = digit_axis(bag_size, intro_index)
+
+    table = child.reshape((n,) * child_bag_size)
+    table = table.reshape(table.shape[:intro_axis] + (1,) + table.shape[intro_axis:])
+    table = table * _along_axes(allowed, bag_size, (intro_axis,))
+
+    for position in nbr_positions:
+        nbr_axis = digit_axis(bag_size, position if position < intro_index else position + 1)
+        table = table * _along_axes(adjacency, bag_size, tuple(sorted((intro_axis, nbr_axis))))
+
+    return table.reshape(-1)
+
+def forget_array(child, n, child_bag_size, forgotten_index):
+    r"""
+    Return the flat DP table of a forget node, summing over the digit of ``forgotten_index``.
+    """
+    table = child.reshape((n,) * child_bag_size)
+    return table.sum(axis=digit_axis(child_bag_size, forgotten_index), keepdims=True).reshape(-1)
+
+def join_array(left, right):
+    r"""
+    Return the flat DP table of a join node.
+    """
+    return left * right
+
+def _along_axes(array, num_axes, axes):
+    r"""
+    Reshape ``array`` to broadcast against ``num_axes`` axes, its own axes becoming ``axes``.
+    """
+    shape = [1] * num_axes
+    for axis, length in zip(axes, array.shape):
+        shape[axis] = length
+    return array.reshape(shape)
@@ -0,0 +1,67 @@
+r"""
+Running counts from asyncio, with deadlines, cancellation and progress reports.
+
+A count runs in a worker thread (the loop's default executor, or the given
+one), so the event loop keeps serving while it runs. The engines check a
+cancellation event between nodes (and between the pieces of split nodes):
+when the awaiting task is cancelled, or its deadline passes, the event is
+set, the worker stops at the next check and drops its tables, and only then
+is the cancellation, or the timeout, raised to the caller.
+"""
+import asyncio
+import threading
+
+
+class CountCancelled(Exception):
+    r"""
+    Raised inside a worker when its count is cancelled.
+    """
+
+
+def check_cancelled(cancel):
+    r"""
+    Raise :class:`CountCancelled` if the event ``cancel`` (possibly None) is set.
+    """
+    if cancel is not None and cancel.is_set():
+        raise CountCancelled()
+
+async def run_in_worker(count, deadline=None, progress=None, executor=None):
+    r"""
+    Return the result of ``count(cancel, report)``, run in a worker thread.
+
+    INPUT:
+
+    - ``count`` -- a function of a `threading.Event`, which it checks with
+      :func:`check_cancelled`, and of a function ``report(*args)``, which it
+      calls to report progress
+
+    - ``deadline`` (default: None) -- the time, in the clock of the running
+      loop (``loop.time()``), after which the count is cancelled and
+      `asyncio.TimeoutError` is raised
+
+    - ``progress`` (default: None) -- a function, called on the event loop
+      with the arguments of every ``report``
+
+    - ``executor`` (default: None) -- a `concurrent.futures.Executor`, by
+      default the loop's default executor
+    """
+    loop = asyncio.get_running_loop()
+    cancel = threading.Event()
+
+    def report(*args):
+        if progress is not None:
+            loop.call_soon_threadsafe(progress, *args)
+
+    future = loop.run_in_executor(executor, count, cancel, report)
+    try:
+        if deadline is None:
+            return await asyncio.shield(future)
+        return await asyncio.wait_for(asyncio.shield(future), timeout=max(0, deadline - loop.time()))
+    except BaseException:
+        # Wait for the worker to stop, so that its tables are released on return
+        cancel.set()
+        try:
+            await future
+        except CountCancelled:
+            pass
+        raise
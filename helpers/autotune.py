@@ -0,0 +1,310 @@
+r"""
+A machine profile, measured once per host, tuning the choices of the counter.
+
+:func:`calibrate` runs short microbenchmarks (a few seconds in all) and
+returns a :class:`MachineProfile`:
+
+- the cost of an intro validity check (the pure-Python path) with the dense
+  bitset representation and with the sparse one, the neighbour sets of a
+  :class:`~helpers.prepared_target.PreparedTarget`, on targets of several
+  densities, giving ``density_thresholds``, for each kind of target the
+  lowest density from which the dense one is not slower;
+- the throughput of the single-threaded compiled intro, forget and join
+  kernels, in entries per second, and the forget bandwidth, in bytes read
+  per second; their mean gives ``operations_per_second``, used by
+  :meth:`~standard_hom_count.GraphHomomorphismCounter.explain`;
+- the speedup of the threaded Numba intro kernel with 1, 2, 4, ... threads,
+  the best ``chunk_size`` of its chunks, and ``threaded_min_entries``, the
+  smallest table from which it beats the compiled kernel (None if it never
+  does, e.g. on one core).
+
+:func:`save_profile` writes the profile as JSON to ``default_profile_path()``
+(``$HOM_COUNT_PROFILE``, or ``~/.cache/count-graph-homs/profile.json``), and
+:func:`machine_profile` loads it, calibrating and saving it the first time.
+
+A :class:`~standard_hom_count.GraphHomomorphismCounter` built with
+``profile=`` takes its default ``density_threshold`` from the profile, for
+the kind of its target, and picks, for every node with int64 tables, the
+compiled or the threaded Numba kernel (with the profile's chunk size); the
+kernel of every node is recorded in its trace, see `helpers/tracing.py`.
+"""
+import json
+import os
+import platform
+import random
+import time
+
+import numpy as np
+
+from helpers.dp_kernels import HAVE_COMPILED_KERNELS, allowed_images
+from helpers.prepared_target import BitsetTarget, PreparedTarget
+
+
+PROFILE_VERSION = 3
+
+DENSITIES = (0.05, 0.1, 0.2, 0.35, 0.5, 0.7, 0.9)
+CHUNK_SIZES = (1 << 12, 1 << 14, 1 << 15, 1 << 16, 1 << 18)
+
+# The sparse representation timed against the bitset one, per kind of target;
+# sparse Sage graphs are converted to prepared targets, see `static_target`
+SPARSE_REPRESENTATIONS = {'prepared': 'sparse', 'sage': 'sparse'}
+
+# Sizes of the tables of the kernel benchmarks
+CHECK_TARGET_SIZE = 256
+KERNEL_TARGET_SIZE = 128
+THRESHOLD_ENTRIES = tuple(4 ** power for power in range(5, 12))
+
+# Time spent per measurement, in seconds
+MEASURE_SECONDS = 0.05
+
+
+class MachineProfile:
+    r"""
+    The measured performance of a host, see :func:`calibrate`.
+
+    Attributes: ``density_thresholds`` (a dictionary keyed by the kinds of
+    target, ``'prepared'`` and ``'sage'``), ``operations_per_second``,
+    ``chunk_size``, ``threaded_min_entries`` (the choices), and ``host``,
+    ``cpu_count``, ``created`` and ``measurements`` (a dictionary of the raw
+    results of the microbenchmarks).
+    """
+    def __init__(self, density_thresholds, operations_per_second, chunk_size, threaded_min_entries,
+                 measurements=None, host=None, cpu_count=None, created=None):
+        self.density_thresholds = density_thresholds
+        self.operations_per_second = operations_per_second
+        self.chunk_size = chunk_size
+        self.threaded_min_entries = threaded_min_entries
+        self.measurements = measurements or {}
+        self.host = host or platform.node()
+        self.cpu_count = cpu_count or os.cpu_count()
+        self.created = created or time.time()
+
+    def __repr__(self):
+        return (f"MachineProfile of {self.host}: density_thresholds={self.density_thresholds}, "
+                f"operations_per_second={self.operations_per_second:.3g}, chunk_size={self.chunk_size}, "
+                f"threaded_min_entries={self.threaded_min_entries}")
+
+    def as_dict(self):
+        return {'version': PROFILE_VERSION, **{key: getattr(self, key) for key in (
+            'density_thresholds', 'operations_per_second', 'chunk_size', 'threaded_min_entries',
+            'measurements', 'host', 'cpu_count', 'created')}}
+
+    @classmethod
+    def from_dict(cls, data):
+        if data.get('version') != PROFILE_VERSION:
+            raise ValueError("the machine profile was saved by another version, calibrate again")
+        return cls(**{key: value for key, value in data.items() if key != 'version'})
+
+    def density_threshold(self, target_graph):
+        r"""
+        Return the density threshold measured for targets of the kind of ``target_graph``.
+        """
+        return self.density_thresholds['prepared' if isinstance(target_graph, PreparedTarget) else 'sage']
+
+    def int64_backend(self, entries):
+        r"""
+        Return the kernel computing a node with int64 tables of ``entries`` entries: ``'compiled'`` or ``'numba'``.
+        """
+        if self.threaded_min_entries is not None and entries >= self.threaded_min_entries:
+            return 'numba'
+        return 'compiled'
+
+
+def threaded_kernels():
+    r"""
+    Return the module of the threaded Numba kernels, `helpers/numba_kernels.py`, imported on first use.
+    """
+    from helpers import numba_kernels
+    return numba_kernels
+
+def default_profile_path():
+    return os.environ.get('HOM_COUNT_PROFILE',
+                          os.path.join(os.path.expanduser('~'), '.cache', 'count-graph-homs', 'profile.json'))
+
+def save_profile(profile, path=None):
+    r"""
+    Write ``profile`` to ``path``, by default ``default_profile_path()``.
+    """
+    path = path or default_profile_path()
+    os.makedirs(os.path.dirname(os.path.abspath(path)), exist_ok=True)
+    with open(path, 'w') as f:
+        json.dump(profile.as_dict(), f, indent=1)
+
+def load_profile(path=None):
+    r"""
+    Return the profile saved in ``path``, by default ``default_profile_path()``, or None if there is none.
+    """
+    path = path or default_profile_path()
+    if not os.path.exists(path):
+        return None
+    with open(path) as f:
+        return MachineProfile.from_dict(json.load(f))
+
+def machine_profile(path=None):
+    r"""
+    Return the profile saved in ``path``, calibrating and saving it first if there is none.
+    """
+    profile = load_profile(path)
+    if profile is None:
+        profile = calibrate()
+        save_profile(profile, path)
+    return profile
+
+
+def calibrate(seed=0):
+    r"""
+    Run the microbenchmarks on this host, and return its :class:`MachineProfile`.
+
+    EXAMPLES::
+
+        sage: from helpers.autotune import calibrate, save_profile
+        sage: profile = calibrate()  # not tested
+        sage: save_profile(profile)  # not tested
+    """
+    rng = random.Random(seed)
+    measurements = {'check_seconds': _validity_check_costs(rng)}
+
+    density_thresholds = {}
+    for kind, sparse in SPARSE_REPRESENTATIONS.items():
+        density_thresholds[kind] = 1.0
+        for density in DENSITIES:
+            costs = measurements['check_seconds'][str(density)]
+            if costs['dense'] <= costs[sparse]:
+                density_thresholds[kind] = density
+                break
+
+    chunk_size = CHUNK_SIZES[2]
+    threaded_min_entries = None
+    operations_per_second = None
+    if HAVE_COMPILED_KERNELS:
+        measurements['kernels'] = _kernel_throughputs()
+        operations_per_second = float(np.mean([measurements['kernels'][kernel]
+                                               for kernel in ('intro', 'forget', 'join')]))
+        try:
+            measurements['threads'] = _thread_scaling()
+        except ImportError:
+            pass
+        else:
+            chunk_size = measurements['threads']['chunk_size']
+            threaded_min_entries = measurements['threads']['threaded_min_entries']
+
+    if operations_per_second is None:
+        # The pure-Python loops do about one check per entry
+        dense = measurements['check_seconds'][str(DENSITIES[-1])]['dense']
+        operations_per_second = 1 / dense
+
+    return MachineProfile(density_thresholds, operations_per_second, chunk_size, threaded_min_entries, measurements)
+
+
+def _measure(function):
+    r"""
+    Return the best time of a call of ``function``, repeating it for about ``MEASURE_SECONDS``.
+    """
+    best = float('inf')
+    deadline = time.perf_counter() + MEASURE_SECONDS
+    while True:
+        start = time.perf_counter()
+        function()
+        end = time.perf_counter()
+        best = min(best, end - start)
+        if end >= deadline:
+            return best
+
+def _random_target(n, density, rng):
+    edges = [(u, v) for u in range(n) for v in range(u + 1, n) if rng.random() < density]
+    return PreparedTarget.from_edges(n, edges)
+
+def _validity_check_costs(rng, num_checks=2000):
+    r"""
+    Return, for every density, the seconds per intro validity check with the dense and sparse representations.
+    """
+    costs = {}
+    n = CHECK_TARGET_SIZE
+    for density in DENSITIES:
+        target = _random_target(n, density, rng)
+        dense = BitsetTarget(target.bitset_rows())
+        target.neighbour_sets()
+        checks = [(rng.randrange(n), [rng.randrange(n) for _ in range(2)]) for _ in range(num_checks)]
+
+        costs[str(density)] = {
+            name: _measure(lambda: [representation.is_valid_mapping(u, nbrs) for u, nbrs in checks]) / num_checks
+            for name, representation in (('dense', dense), ('sparse', target))
+        }
+    return costs
+
+def _kernel_tables(n):
+    rng = np.random.default_rng(0)
+    adjacency = (rng.random((n, n)) < 0.3).astype(np.uint8)
+    adjacency = np.ascontiguousarray(np.triu(adjacency, 1) | np.triu(adjacency, 1).T)
+    child = rng.integers(0, 100, n ** 2, dtype=np.int64)
+    return adjacency, child, allowed_images(n)
+
+def _kernel_throughputs():
+    r"""
+    Return the entries per second of the compiled kernels, and the forget bandwidth in bytes per second.
+    """
+    from helpers.dp_kernels import intro_kernel, forget_kernel, join_kernel
+
+    n = KERNEL_TARGET_SIZE
+    adjacency, child, allowed = _kernel_tables(n)
+    big = np.tile(child, n)
+
+    intro = _measure(lambda: intro_kernel(child, n, 1, [0, 1], adjacency, allowed))
+    forget = _measure(lambda: forget_kernel(big, n, 1))
+    join = _measure(lambda: join_kernel(big, big))
+    return {
+        'intro': n ** 3 / intro,
+        'forget': n ** 3 / forget,
+        'join': n ** 3 / join,
+        'forget_bytes_per_second': big.nbytes / forget,
+    }
+
+def _thread_scaling():
+    r"""
+    Return the speedups of the threaded Numba intro kernel, its best chunk size, and the table size from which it pays off.
+    """
+    import numba
+    from helpers.dp_kernels import intro_kernel
+    from helpers.numba_kernels import intro_table
+
+    n = KERNEL_TARGET_SIZE
+    adjacency, child, allowed = _kernel_tables(n)
+    max_threads = numba.config.NUMBA_NUM_THREADS
+    previous_threads = numba.get_num_threads()
+
+    try:
+        chunk_seconds = {chunk_size: _measure(lambda: intro_table(child, n, 1, [0, 1], adjacency, allowed, chunk_size))
+                         for chunk_size in CHUNK_SIZES}
+        chunk_size = min(chunk_seconds, key=chunk_seconds.get)
+
+        speedups = {}
+        threads = 1
+        while True:
+            numba.set_num_threads(threads)
+            speedups[str(threads)] = _measure(lambda: intro_table(child, n, 1, [0, 1], adjacency, allowed, chunk_size))
+            if threads == max_threads:
+                break
+            threads = min(2 * threads, max_threads)
+        numba.set_num_threads(max_threads)
+        speedups = {threads: speedups['1'] / seconds for threads, seconds in speedups.items()}
+
+        # Intro tables of about `entries` entries over a target of `m` vertices
+        threaded_min_entries = None
+        for entries in THRESHOLD_ENTRIES:
+            m = int(round(entries ** (1 / 3)))
+            small_adjacency, small_child, small_allowed = _kernel_tables(m)
+            compiled = _measure(lambda: intro_kernel(small_child, m, 1, [0, 1], small_adjacency, small_allowed))
+            threaded = _measure(lambda: intro_table(small_child, m, 1, [0, 1], small_adjacency, small_allowed,
+                                                    chunk_size))
+            if threaded < compiled:
+                threaded_min_entries = entries
+                break
+    finally:
+        numba.set_num_threads(previous_threads)
+
+    return {
+        'chunk_seconds': {str(size): seconds for size, seconds in chunk_seconds.items()},
+        'chunk_size': chunk_size,
+        'speedups': speedups,
+        'threaded_min_entries': threaded_min_entries,
+    }
@@ -0,0 +1,187 @@
+r"""
+Checkpoints of DP tables, to resume long counts after a preemption.
+
+A checkpoint directory may hold the checkpoints of many counts. Each count
+gets its own sub-directory, named after a key hashing the pattern (with its
+colours), the target, the tree decomposition and ``PLAN_VERSION``, so that a
+table is only ever reused by the very same computation. The sub-directory
+holds a ``manifest.json`` describing the key, and one ``<name>.npy`` file
+per saved table (``node-<index>`` for the table of a node, ``shard-<i>``
+for the count of a shard).
+
+Every file is written to a temporary name and then renamed, which is atomic:
+a table file exists if and only if it is complete, even after a crash, and
+with several processes writing at once. Writes overlap with the
+computation: the standard engine writes on a background thread, and
+:meth:`Checkpoint.flush` waits for them; the parallel engine writes every
+table in a Dask task of its own, which no computing task depends on, and its
+result waits for all of them with :func:`after_writes`, so that writes made
+by other processes or machines are complete, and their errors raised.
+
+Tables of exact Python integers are saved as object arrays, i.e. pickled:
+only resume from checkpoint directories you trust.
+"""
+import hashlib
+import json
+import os
+import tempfile
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+
+from helpers.prepared_target import PreparedTarget
+
+
+# Bump whenever the layout of the tables, or the way nodes are named, changes
+PLAN_VERSION = 1
+
+
+class Checkpoint:
+    r"""
+    The saved tables of one count, in a sub-directory of ``checkpoint_dir``.
+
+    INPUT:
+
+    - ``checkpoint_dir`` -- the checkpoint directory, created if needed
+
+    - ``manifest`` -- a JSON-serialisable description of the count; its hash
+      names the sub-directory
+    """
+    def __init__(self, checkpoint_dir, manifest):
+        self.key = hashlib.sha256(json.dumps(manifest, sort_keys=True).encode()).hexdigest()
+        self.path = os.path.join(checkpoint_dir, self.key[:32])
+        self._writer = None
+        self._pending = []
+
+        os.makedirs(self.path, exist_ok=True)
+        manifest_path = os.path.join(self.path, 'manifest.json')
+        if not os.path.exists(manifest_path):
+            _atomic_write(manifest_path, lambda f: f.write(json.dumps(dict(manifest, key=self.key),
+                                                                      sort_keys=True, indent=1).encode()))
+
+    def __getstate__(self):
+        # Worker processes start their own writer thread
+        return {'key': self.key, 'path': self.path}
+
+    def __setstate__(self, state):
+        self.__dict__.update(state, _writer=None, _pending=[])
+
+    def has(self, name):
+        r"""
+        Return whether the table ``name`` has been saved.
+        """
+        return os.path.exists(self._table_path(name))
+
+    def load(self, name, dtype=None):
+        r"""
+        Return the saved table ``name``, as an int64 or object numpy array, or as ``dtype`` if given.
+        """
+        table = np.load(self._table_path(name), allow_pickle=True)
+        return table if dtype is None else table.astype(dtype, copy=False)
+
+    def save(self, name, table):
+        r"""
+        Save ``table`` as ``name`` in the background, and return it.
+
+        ``table`` (a numpy array or a list of integers) must not be modified afterwards.
+        """
+        if self._writer is None:
+            self._writer = ThreadPoolExecutor(max_workers=1)
+        self._pending.append(self._writer.submit(self._write, name, table))
+        return table
+
+    def write(self, name, table):
+        r"""
+        Save ``table`` as ``name`` in the calling thread.
+
+        This is the body of the write tasks of the parallel engine, which
+        return nothing so that the table is not sent back.
+        """
+        self._write(name, table)
+
+    def flush(self):
+        r"""
+        Wait for every background write of this process, raising the first error.
+        """
+        pending, self._pending = self._pending, []
+        for future in pending:
+            future.result()
+
+    def _write(self, name, table):
+        if not isinstance(table, np.ndarray):
+            table = np.array(table, dtype=np.int64 if all(-2**63 <= x < 2**63 for x in table) else object)
+        _atomic_write(self._table_path(name), lambda f: np.save(f, table, allow_pickle=table.dtype == object))
+
+    def _table_path(self, name):
+        return os.path.join(self.path, f"{name}.npy")
+
+
+def counter_checkpoint(counter, checkpoint_dir, plan=None):
+    r"""
+    Return the :class:`Checkpoint` of the count of ``counter`` in ``checkpoint_dir``.
+
+    Both engines name and lay out their tables alike, so a count started with
+    one engine can be resumed with the other. ``plan`` describes anything else
+    the saved results depend on, e.g. the shards of a sharded count.
+    """
+    return Checkpoint(checkpoint_dir, counter_manifest(counter, plan))
+
+def counter_manifest(counter, plan=None):
+    r"""
+    Return a JSON-serialisable description of the count of ``counter``: its pattern, target and decomposition.
+    """
+    decomposition = counter.dir_labelled_TD
+    return {
+        'plan_version': PLAN_VERSION,
+        'pattern': {
+            'vertices': sorted(map(repr, counter.graph)),
+            'edges': sorted(sorted(map(repr, edge)) for edge in counter.graph.edges(labels=False)),
+            'colours': counter.graph_clr if counter.colourful else None,
+        },
+        'target': {
+            'sha256': target_fingerprint(counter.target_graph),
+            'colours': counter.target_clr if counter.colourful else None,
+        },
+        'decomposition': sorted([node[0], sorted(map(repr, node[1])), decomposition.get_vertex(node),
+                                 sorted(child[0] for child in decomposition.neighbors_out(node))]
+                                for node in decomposition),
+        'plan': plan,
+    }
+
+def target_fingerprint(target_graph):
+    r"""
+    Return the SHA-256 of the adjacency structure of ``target_graph``, a Sage graph or a ``PreparedTarget``.
+    """
+    if not isinstance(target_graph, PreparedTarget):
+        target_graph = PreparedTarget.from_graph(target_graph)
+
+    digest = hashlib.sha256()
+    digest.update(np.int64(target_graph.num_vertices).tobytes())
+    digest.update(np.ascontiguousarray(target_graph.indptr, dtype=np.int64).tobytes())
+    digest.update(np.ascontiguousarray(target_graph.indices, dtype=np.int64).tobytes())
+    return digest.hexdigest()
+
+def after_writes(result, *writes):
+    r"""
+    Return ``result``, as a Dask task also depending on the write tasks ``writes``.
+
+    A count returning this waits for its writes, and raises their errors,
+    while no computing task waits for them.
+    """
+    return result
+
+def _atomic_write(path, write):
+    r"""
+    Write ``path`` through ``write(file)`` on a temporary file, renamed when complete.
+    """
+    directory = os.path.dirname(path)
+    fd, temporary_path = tempfile.mkstemp(dir=directory, prefix='.tmp-')
+    try:
+        with os.fdopen(fd, 'wb') as f:
+            write(f)
+            f.flush()
+            os.fsync(f.fileno())
+        os.replace(temporary_path, path)
+    except BaseException:
+        os.remove(temporary_path)
+        raise
@@ -0,0 +1,112 @@
+r"""
+DP tables as chunked `dask.array`s, for tables larger than memory.
+
+A table over a bag of size `k` is kept as an array of shape `(n,) * k`
+rather than flat: bag position `i` sits on axis `k - 1 - i` (see
+`helpers/array_kernels.py`), which is exactly the mixed-radix encoding of the
+flat table in C order. Intro then inserts an axis and multiplies blockwise by
+adjacency blocks, forget is a chunked sum over one axis, and join is a
+blockwise product; Dask runs the blocks of a single node on all cores, and
+only ever holds a few blocks of each table in memory.
+
+Tables are chunked along their leading axes: the trailing axes are kept
+whole, and the leading ones are split, so that a block holds at most
+``chunk_entries`` entries and its flat entries stay contiguous.
+"""
+import warnings
+
+import dask.array as da
+
+from helpers.array_kernels import digit_axis, _along_axes
+
+
+# Entries per block: 1M int64 entries, i.e. 8 MiB
+CHUNK_ENTRIES = 1 << 20
+
+
+def table_chunks(bag_size, n, chunk_entries=CHUNK_ENTRIES):
+    r"""
+    Return the block shape of a table over ``bag_size`` vertices, split along its leading axes.
+    """
+    chunks = []
+    entries = 1
+    for _ in range(bag_size):
+        size = min(n, max(1, chunk_entries // entries))
+        chunks.append(size)
+        entries *= size
+    return tuple(reversed(chunks))
+
+def dask_table(spec, chunk_entries=CHUNK_ENTRIES):
+    r"""
+    Return the table computed by the program of ``spec`` as a lazy, chunked dask array.
+
+    INPUT:
+
+    - ``spec`` -- a :class:`~helpers.task_specs.TaskSpec` without ``'input'`` instructions
+
+    - ``chunk_entries`` (default: ``CHUNK_ENTRIES``) -- the maximum number of entries per block
+
+    OUTPUT: an array of shape `(n,) * k`, where `k` is the bag size of the last node
+    """
+    target = spec.target
+    adjacency = target.load()[0]
+    n = target.size
+    stack = []
+
+    for instruction in spec.program:
+        match instruction[0]:
+            case 'leaf':
+                stack.append(da.ones((), dtype=spec.dtype))
+            case 'intro':
+                _, _, intro_index, nbr_positions, colour, pinned = instruction
+                stack.append(_intro(stack.pop(), n, intro_index, nbr_positions, adjacency,
+                                    target.allowed(colour, spec.domain if pinned else None), chunk_entries))
+            case 'forget':
+                _, _, forgotten_index = instruction
+                child = stack.pop()
+                forgotten_axis = digit_axis(child.ndim, forgotten_index)
+                # Summing object blocks down to 0-d would give Python ints, not arrays
+                table = child.sum(axis=forgotten_axis, dtype=child.dtype, keepdims=True).squeeze(axis=forgotten_axis)
+                stack.append(table.rechunk(table_chunks(table.ndim, n, chunk_entries)))
+            case 'join':
+                right, left = stack.pop(), stack.pop()
+                stack.append(left * right)
+            case _:
+                raise ValueError(f"cannot build a dask table from instruction {instruction!r}")
+
+    (table,) = stack
+    return table
+
+def _intro(child, n, intro_index, nbr_positions, adjacency, allowed, chunk_entries):
+    r"""
+    Return the table of an intro node, see :func:`~helpers.array_kernels.intro_array`.
+
+    Every operand is chunked like the output, so that no block grows by a
+    factor `n` when the intro axis is broadcast.
+    """
+    bag_size = child.ndim + 1
+    chunks = table_chunks(bag_size, n, chunk_entries)
+    intro_axis = digit_axis(bag_size, intro_index)
+
+    table = child.rechunk(chunks[:intro_axis] + chunks[intro_axis + 1:])
+    table = table[(slice(None),) * intro_axis + (None,)]
+
+    # Splitting the broadcast intro axis into blocks is the point
+    with warnings.catch_warnings():
+        warnings.simplefilter('ignore', da.PerformanceWarning)
+        table = table * _operand(allowed, bag_size, (intro_axis,), chunks)
+
+        for position in nbr_positions:
+            nbr_axis = digit_axis(bag_size, position if position < intro_index else position + 1)
+            table = table * _operand(adjacency, bag_size, tuple(sorted((intro_axis, nbr_axis))), chunks)
+
+    return table
+
+def _operand(array, num_axes, axes, chunks):
+    r"""
+    Return ``array`` as a dask array broadcasting against ``num_axes`` axes, chunked like ``chunks``.
+    """
+    operand = _along_axes(array, num_axes, axes)
+    # The adjacency matrix is the same numpy array at every node, no need to hash it
+    return da.from_array(operand, chunks=tuple(chunks[axis] if length > 1 else 1
+                                               for axis, length in enumerate(operand.shape)), name=False)
@@ -0,0 +1,32 @@
+import numpy as np
+
+# The compiled kernels are optional: build them with
+# `python setup.py build_ext --inplace`. Without them, the engines run
+# their pure-Python loops, which give exactly the same integers.
+try:
+    from helpers._dp_kernels import intro_kernel, forget_kernel, join_kernel
+    HAVE_COMPILED_KERNELS = True
+except ImportError:
+    HAVE_COMPILED_KERNELS = False
+
+
+def exact_table(table):
+    r"""
+    Return the DP table ``table`` as a list of Python integers.
+
+    Tables produced by the compiled kernels are int64 numpy arrays; they are
+    converted when a result no longer fits in 64 bits, and the computation
+    carries on with exact Python integers.
+    """
+    if isinstance(table, np.ndarray):
+        return table.tolist()
+    return table
+
+def allowed_images(target_size, target_clr=None, vtx_clr=None):
+    r"""
+    Return, as a uint8 array, which target vertices a pattern vertex of colour ``vtx_clr`` may map to.
+    """
+    if target_clr is None:
+        return np.ones(target_size, dtype=np.uint8)
+    return np.fromiter((target_clr[v] == vtx_clr for v in range(target_size)),
+                       dtype=np.uint8, count=target_size)
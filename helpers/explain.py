@@ -0,0 +1,205 @@
+r"""
+Cost estimates of a count, before running it.
+
+:func:`estimate_count` walks the labelled nice decomposition of a counter and
+predicts, for every node, with `n` the target size and `k` the bag size:
+
+- ``entries``: the length of its table, `n^k`;
+- ``nonzero_entries``: the entries expected to be nonzero, assuming the target
+  is a random graph of its density `p`: a mapping of the bag survives every
+  pattern edge inside the bag with probability `p`, and the colour of every
+  bag vertex in a colourful count with the fraction of target vertices of
+  that colour. Edges to vertices forgotten below the node are ignored, so
+  this is an upper estimate, loosest at forget nodes;
+- ``operations``: the additions, multiplications and adjacency tests of the
+  node: `n^k (1 + d)` for an intro node whose vertex has `d` neighbours in
+  the bag, `n^{k + 1}` for a forget node, `n^k` for a join node;
+- ``table_bytes``: 8 bytes per entry for int64 tables, ``EXACT_ENTRY_BYTES``
+  for tables of exact Python integers (when `n^{|V(G)|}` does not fit in 64 bits);
+- ``live_bytes``: the bytes of the tables alive as the node is computed,
+  evaluating the nodes bottom-up as the engines do, and releasing a table as
+  soon as its parent is computed: the table of the node and those of its
+  children are all alive then.
+
+:class:`~standard_hom_count.GraphHomomorphismCounter` keeps every table until
+the count returns, so its peak is ``retained_bytes``, the sum of all tables;
+the parallel engine releases tables as above, so its peak is ``peak_live_bytes``.
+
+The predicted time divides the operations by ``operations_per_second``, a
+rough throughput of the int64 kernels on one core (``EXACT_SLOWDOWN`` times
+slower for exact integers): it tells a second from a week, not more.
+"""
+from collections import namedtuple
+from itertools import combinations
+
+
+# Nodes doing at least this fraction of the operations are hot
+HOT_FRACTION = 0.1
+
+INT64_ENTRY_BYTES = 8
+
+# A pointer and a Python integer of a few digits
+EXACT_ENTRY_BYTES = 40
+
+# Rough throughputs, see the module documentation
+OPERATIONS_PER_SECOND = 1e8
+EXACT_SLOWDOWN = 20
+
+NodeEstimate = namedtuple('NodeEstimate', ['node', 'type', 'bag_size', 'depth', 'entries', 'nonzero_entries',
+                                           'operations', 'table_bytes', 'live_bytes', 'hot'])
+
+
+class CountEstimate:
+    r"""
+    The estimates of every node of a count, see :func:`estimate_count`.
+
+    Attributes: ``nodes``, a list of :class:`NodeEstimate` (the root first, each
+    node before its children), ``target_size``, ``target_density``,
+    ``int64_tables``, ``operations``, ``retained_bytes``, ``peak_live_bytes``,
+    ``peak_node`` (the index of the node computed at the peak) and
+    ``predicted_seconds``.
+    """
+    def __init__(self, nodes, target_size, target_density, int64_tables, predicted_seconds):
+        self.nodes = nodes
+        self.target_size = target_size
+        self.target_density = target_density
+        self.int64_tables = int64_tables
+        self.operations = sum(node.operations for node in nodes)
+        self.retained_bytes = sum(node.table_bytes for node in nodes)
+        peak = max(nodes, key=lambda node: node.live_bytes)
+        self.peak_live_bytes = peak.live_bytes
+        self.peak_node = peak.node
+        self.predicted_seconds = predicted_seconds
+
+    def __repr__(self):
+        return (f"CountEstimate of {len(self.nodes)} nodes: {self.operations:.3g} operations, "
+                f"~{_format_seconds(self.predicted_seconds)}, peak {_format_bytes(self.peak_live_bytes)} live, "
+                f"{_format_bytes(self.retained_bytes)} retained")
+
+    def hot_nodes(self):
+        r"""
+        Return the estimates of the hot nodes, the most expensive first.
+        """
+        return sorted((node for node in self.nodes if node.hot), key=lambda node: node.operations, reverse=True)
+
+    def as_dict(self):
+        r"""
+        Return the estimates as a JSON-serialisable dictionary.
+        """
+        return {
+            'target_size': self.target_size,
+            'target_density': self.target_density,
+            'int64_tables': self.int64_tables,
+            'operations': self.operations,
+            'retained_bytes': self.retained_bytes,
+            'peak_live_bytes': self.peak_live_bytes,
+            'peak_node': self.peak_node,
+            'predicted_seconds': self.predicted_seconds,
+            'nodes': [node._asdict() for node in self.nodes],
+        }
+
+    def format_tree(self):
+        r"""
+        Return a tree view of the estimates, one line per node.
+
+        Chains of nodes are listed at the same indentation, and the children of
+        a join node are indented below it.
+        """
+        lines = [repr(self)]
+        for node in self.nodes:
+            lines.append(f"{'  ' * node.depth}{node.type:<6} {node.node:>4}  bag {node.bag_size:>2}  "
+                         f"{node.entries:>9.3g} entries  {node.nonzero_entries:>9.3g} nonzero  "
+                         f"{node.operations:>9.3g} ops  live {_format_bytes(node.live_bytes):>9}"
+                         + ("  HOT" if node.hot else ""))
+        return "\n".join(lines)
+
+
+def estimate_count(counter, operations_per_second=OPERATIONS_PER_SECOND, hot_fraction=HOT_FRACTION):
+    r"""
+    Return the :class:`CountEstimate` of the count of ``counter``, without running it.
+
+    INPUT:
+
+    - ``counter`` -- a counter of either engine, with its decomposition
+
+    - ``operations_per_second`` (default: ``OPERATIONS_PER_SECOND``) -- the
+      throughput used to predict the time
+
+    - ``hot_fraction`` (default: ``HOT_FRACTION``) -- nodes doing at least this
+      fraction of the operations are flagged as hot
+    """
+    decomposition = counter.dir_labelled_TD
+    graph = counter.graph
+    n = counter.actual_target_size
+    density = counter.actual_target_graph.density() if n > 1 else 0.0
+    int64_tables = n ** len(graph) < 2 ** 63
+    entry_bytes = INT64_ENTRY_BYTES if int64_tables else EXACT_ENTRY_BYTES
+
+    colour_fraction = {}
+    if counter.colourful:
+        for vertex in graph:
+            colour = counter.graph_clr[vertex]
+            colour_fraction[vertex] = sum(1 for target_colour in counter.target_clr if target_colour == colour) / n
+
+    # Parents before children; a join node's children are one level deeper
+    depth = {counter.root: 0}
+    walk = []
+    stack = [counter.root]
+    while stack:
+        node = stack.pop()
+        walk.append(node)
+        children = decomposition.neighbors_out(node)
+        for child in children:
+            depth[child] = depth[node] + (len(children) > 1)
+        stack.extend(sorted(children, reverse=True))
+
+    estimates = {}
+    for node in walk:
+        node_type = decomposition.get_vertex(node)
+        bag = tuple(node[1])
+        entries = n ** len(bag)
+
+        nonzero = entries * density ** sum(1 for u, v in combinations(bag, 2) if graph.has_edge(u, v))
+        for vertex in bag:
+            nonzero *= colour_fraction.get(vertex, 1)
+
+        match node_type:
+            case 'intro':
+                changed = counter.node_changes_dict[node[0]]
+                operations = entries * (1 + sum(1 for vertex in bag if graph.has_edge(changed, vertex)))
+            case 'forget':
+                operations = entries * n
+            case 'join':
+                operations = entries
+            case _:
+                operations = 1
+
+        estimates[node] = [node[0], node_type, len(bag), depth[node], entries, nonzero, operations,
+                           entries * entry_bytes]
+
+    # Bottom-up, as the engines evaluate the nodes
+    live = 0
+    live_bytes = {}
+    for node in sorted(walk, reverse=True):
+        live += estimates[node][7]
+        live_bytes[node] = live
+        live -= sum(estimates[child][7] for child in decomposition.neighbors_out(node))
+
+    operations = sum(estimate[6] for estimate in estimates.values())
+    nodes = [NodeEstimate(*estimates[node], live_bytes[node], estimates[node][6] >= hot_fraction * operations)
+             for node in walk]
+    seconds = operations / operations_per_second * (1 if int64_tables else EXACT_SLOWDOWN)
+    return CountEstimate(nodes, n, density, int64_tables, seconds)
+
+
+def _format_bytes(num_bytes):
+    for unit in ('B', 'KiB', 'MiB', 'GiB', 'TiB'):
+        if num_bytes < 1024 or unit == 'TiB':
+            return f"{num_bytes:.0f} {unit}" if unit == 'B' else f"{num_bytes:.1f} {unit}"
+        num_bytes /= 1024
+
+def _format_seconds(seconds):
+    for unit, length in (('days', 86400), ('h', 3600), ('min', 60)):
+        if seconds >= length:
+            return f"{seconds / length:.1f} {unit}"
+    return f"{seconds:.3g} s"
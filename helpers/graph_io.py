@@ -0,0 +1,348 @@
+import mmap
+import os
+
+import numpy as np
+
+from helpers.prepared_target import PreparedTarget
+
+
+# Binary CSR files have the following layout, all integers little-endian:
+#
+#   b"HOMCSR01"                                 magic, 8 bytes
+#   then, for every graph:
+#     n, nnz                                    2 x int64
+#     indptr                                    (n + 1) x int64
+#     indices                                   nnz x int32
+#     zero padding up to a multiple of 8 bytes
+#
+# Each undirected edge is stored in both directions, so `nnz` is twice the
+# number of edges. The records are 8-byte aligned, so that the arrays can be
+# used straight from the memory map without copying.
+CSR_MAGIC = b"HOMCSR01"
+
+# Text edge lists: one graph per block of lines, blocks separated by blank
+# lines; each line is an edge `u v`, or a single vertex `v` (for isolated
+# vertices), the vertices being `0, 1, ..., n - 1`; `#` starts a comment
+EDGE_LIST_SUFFIXES = ('.edges', '.edgelist')
+
+_GRAPH6_HEADER = b">>graph6<<"
+_SPARSE6_HEADER = b">>sparse6<<"
+
+
+### Reading
+
+def iter_graph_file(path, start=0, end=None):
+    r"""
+    Lazily yield the graphs stored in ``path`` as prepared targets.
+
+    The file is memory-mapped. It is either a binary CSR file (recognised by
+    its magic bytes), an edge list (recognised by its suffix, one of
+    ``EDGE_LIST_SUFFIXES``) or a text file with one graph6 or sparse6 string
+    per line.
+
+    INPUT:
+
+    - ``path`` -- path to the file
+
+    - ``start``, ``end`` (default: whole file) -- a byte range; exactly the
+      graphs whose record (or line) *starts* in ``[start, end)`` are yielded,
+      so that adjacent ranges never share or lose a graph
+
+    OUTPUT:
+
+    - an iterator of :class:`~helpers.prepared_target.PreparedTarget`, each
+      named ``"<file name>:<byte offset>"``
+
+    EXAMPLES::
+
+        sage: from helpers.graph_io import iter_graph_file
+        sage: for target in iter_graph_file("molecules.g6"):  # not tested
+        ....:     counter = GraphHomomorphismCounter(square, target)
+        ....:     print(target.name, counter.count_homomorphisms())
+    """
+    if os.path.getsize(path) == 0:
+        return iter(())
+
+    with open(path, 'rb') as f:
+        is_csr = f.read(len(CSR_MAGIC)) == CSR_MAGIC
+
+    if is_csr:
+        return _iter_csr_file(path, start, end)
+    if path.endswith(EDGE_LIST_SUFFIXES):
+        return _iter_edge_list_file(path, start, end)
+    return _iter_graph6_file(path, start, end)
+
+def iter_graph_files(paths):
+    r"""
+    Lazily yield the graphs of all files in ``paths``, in order.
+    """
+    for path in paths:
+        yield from iter_graph_file(path)
+
+def split_graph_files(paths, num_parts):
+    r"""
+    Split the dataset made of ``paths`` into ``num_parts`` parts of nearly equal byte size.
+
+    Every part is a list of ``(path, start, end)`` byte ranges, to be handed to
+    one worker process and read with :func:`iter_graph_ranges`. No file is
+    opened here: the readers align the ranges to line or record boundaries.
+
+    EXAMPLES::
+
+        sage: from helpers.graph_io import split_graph_files
+        sage: split_graph_files(["a.g6", "b.g6"], 2)  # not tested, both files of 100 bytes
+        [[('a.g6', 0, 100)], [('b.g6', 0, 100)]]
+    """
+    if num_parts < 1:
+        raise ValueError("num_parts must be positive")
+
+    sizes = [os.path.getsize(path) for path in paths]
+    total = sum(sizes)
+    cuts = [total * part // num_parts for part in range(num_parts + 1)]
+
+    parts = [[] for _ in range(num_parts)]
+    file_start = 0
+    for path, size in zip(paths, sizes):
+        file_end = file_start + size
+        for part in range(num_parts):
+            start, end = max(cuts[part], file_start), min(cuts[part + 1], file_end)
+            if start < end:
+                parts[part].append((path, start - file_start, end - file_start))
+        file_start = file_end
+
+    return parts
+
+def iter_graph_ranges(ranges):
+    r"""
+    Lazily yield the graphs of a part returned by :func:`split_graph_files`.
+    """
+    for path, start, end in ranges:
+        yield from iter_graph_file(path, start, end)
+
+def _iter_graph6_file(path, start, end):
+    name = os.path.basename(path)
+
+    with open(path, 'rb') as f, mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as data:
+        end = len(data) if end is None else min(end, len(data))
+
+        # Skip the line cut by `start`, it belongs to the previous range
+        position = start
+        if position > 0 and data[position - 1] != ord('\n'):
+            newline = data.find(b'\n', position)
+            position = len(data) if newline < 0 else newline + 1
+
+        while position < end:
+            newline = data.find(b'\n', position)
+            line_end = len(data) if newline < 0 else newline
+            line = data[position:line_end].rstrip(b'\r')
+
+            if line:
+                yield parse_graph6(line, name=f"{name}:{position}")
+
+            position = line_end + 1
+
+def _iter_edge_list_file(path, start, end):
+    name = os.path.basename(path)
+
+    with open(path, 'rb') as f, mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as data:
+        end = len(data) if end is None else min(end, len(data))
+
+        # A graph is yielded if its first line starts in the range
+        block_start, num_vertices, edges = None, 0, []
+        position = 0
+        while position <= len(data):
+            newline = data.find(b'\n', position)
+            line_end = len(data) if newline < 0 else newline
+            raw_line = data[position:line_end].strip()
+            line = raw_line.split(b'#', 1)[0].split()
+
+            if line and block_start is None:
+                if position >= end:
+                    return
+                block_start = position
+            if line:
+                vertices = [int(vertex) for vertex in line]
+                if len(vertices) > 2:
+                    raise ValueError(f"invalid edge list line at byte {position} of {path}")
+                num_vertices = max(num_vertices, max(vertices) + 1)
+                if len(vertices) == 2:
+                    edges.append(vertices)
+
+            if block_start is not None and (not raw_line or line_end == len(data)):
+                if block_start >= start:
+                    yield PreparedTarget.from_edges(num_vertices, edges, name=f"{name}:{block_start}")
+                block_start, num_vertices, edges = None, 0, []
+
+            position = line_end + 1
+
+def _iter_csr_file(path, start, end):
+    name = os.path.basename(path)
+
+    # The arrays we yield are views into the map, and keep it alive
+    with open(path, 'rb') as f:
+        data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+    end = len(data) if end is None else min(end, len(data))
+
+    position = len(CSR_MAGIC)
+    while position < end:
+        num_vertices, nnz = np.frombuffer(data, dtype='<i8', count=2, offset=position)
+        indptr_offset = position + 16
+        indices_offset = indptr_offset + 8 * (int(num_vertices) + 1)
+        record_end = _align(indices_offset + 4 * int(nnz))
+
+        if record_end > len(data):
+            raise ValueError(f"truncated CSR record at byte {position} of {path}")
+
+        if position >= start:
+            indptr = np.frombuffer(data, dtype='<i8', count=num_vertices + 1, offset=indptr_offset)
+            indices = np.frombuffer(data, dtype='<i4', count=nnz, offset=indices_offset)
+            yield PreparedTarget(num_vertices, indptr, indices, name=f"{name}:{position}")
+
+        position = record_end
+
+def _align(offset):
+    return (offset + 7) & ~7
+
+
+### graph6 and sparse6 parsing
+
+def parse_graph6(string, name=None):
+    r"""
+    Return the prepared target encoded by a graph6 or sparse6 string.
+
+    The string may be ``str`` or ``bytes``, with or without the
+    ``>>graph6<<`` / ``>>sparse6<<`` header. See the formats description at
+    https://users.cecs.anu.edu.au/~bdm/data/formats.txt
+
+    EXAMPLES::
+
+        sage: from helpers.graph_io import parse_graph6
+        sage: parse_graph6("Bw")
+        Prepared target on 3 vertices and 3 edges
+        sage: parse_graph6(":Bd")
+        Prepared target on 3 vertices and 2 edges
+    """
+    if isinstance(string, str):
+        string = string.encode('ascii')
+    string = string.strip()
+
+    if string.startswith(_GRAPH6_HEADER):
+        string = string[len(_GRAPH6_HEADER):]
+    elif string.startswith(_SPARSE6_HEADER):
+        string = string[len(_SPARSE6_HEADER):]
+
+    if string[:1] == b':':
+        return _parse_sparse6(_six_bit_values(string[1:]), name)
+    return _parse_graph6(_six_bit_values(string), name)
+
+def _six_bit_values(string):
+    values = np.frombuffer(string, dtype=np.uint8).astype(np.int64) - 63
+    if len(values) == 0 or values.min() < 0 or values.max() > 63:
+        raise ValueError(f"invalid graph6/sparse6 string: {string[:32]!r}")
+    return values
+
+def _decode_size(values):
+    r"""
+    Return the number of vertices `n` and the number of values used to encode it.
+    """
+    if values[0] < 63:
+        return int(values[0]), 1
+    if values[1] < 63:
+        return _big_endian(values[1:4]), 4
+    return _big_endian(values[2:8]), 8
+
+def _big_endian(values):
+    number = 0
+    for value in values.tolist():
+        number = (number << 6) | value
+    return number
+
+def _parse_graph6(values, name):
+    num_vertices, offset = _decode_size(values)
+    num_bits = num_vertices * (num_vertices - 1) // 2
+
+    bits = np.unpackbits(values[offset:].astype(np.uint8)[:, None], axis=1)[:, 2:].ravel()
+    if len(bits) < num_bits:
+        raise ValueError("truncated graph6 string")
+
+    # graph6 lists the upper triangle column by column, i.e. the pairs (i, j)
+    # with i < j in the order (0, 1), (0, 2), (1, 2), (0, 3), ...; this is the
+    # row-major order of the strict lower triangle with (row, column) = (j, i)
+    rows, columns = np.tril_indices(num_vertices, -1)
+    present = bits[:num_bits].astype(np.bool_)
+
+    return PreparedTarget._from_edge_array(num_vertices, columns[present], rows[present], name)
+
+def _parse_sparse6(values, name):
+    num_vertices, offset = _decode_size(values)
+    width = max(1, (num_vertices - 1).bit_length())
+
+    heads, tails = [], []
+    current = 0
+    for flag, vertex in _sparse6_pairs(values[offset:].tolist(), width):
+        if flag:
+            current += 1
+        # Padding with ones may produce out-of-range values at the end
+        if vertex >= num_vertices or current >= num_vertices:
+            break
+        if vertex > current:
+            current = vertex
+        else:
+            heads.append(vertex)
+            tails.append(current)
+
+    return PreparedTarget._from_edge_array(num_vertices, np.array(heads, dtype=np.int64),
+                                           np.array(tails, dtype=np.int64), name)
+
+def _sparse6_pairs(values, width):
+    r"""
+    Yield the pairs `(b_i, x_i)` of a sparse6 bit stream, `x_i` being ``width`` bits long.
+    """
+    chunks = iter(values)
+    word, word_bits = 0, 0
+
+    while True:
+        if word_bits < 1:
+            word = next(chunks, None)
+            if word is None:
+                return
+            word_bits = 6
+
+        word_bits -= 1
+        flag = (word >> word_bits) & 1
+
+        vertex = word & ((1 << word_bits) - 1)
+        vertex_bits = word_bits
+        while vertex_bits < width:
+            word = next(chunks, None)
+            if word is None:
+                return
+            vertex = (vertex << 6) | word
+            vertex_bits += 6
+
+        word_bits = vertex_bits - width
+        yield flag, vertex >> word_bits
+
+
+### Writing
+
+def write_csr_file(path, targets):
+    r"""
+    Write the graphs ``targets`` (Sage graphs or prepared targets) as a binary CSR file.
+
+    Return the number of graphs written.
+    """
+    count = 0
+    with open(path, 'wb') as f:
+        f.write(CSR_MAGIC)
+        for target in targets:
+            if not isinstance(target, PreparedTarget):
+                target = PreparedTarget.from_graph(target)
+
+            record = np.array([target.num_vertices, len(target.indices)], dtype='<i8').tobytes()
+            record += target.indptr.astype('<i8').tobytes()
+            record += target.indices.astype('<i4').tobytes()
+            f.write(record + bytes(_align(len(record)) - len(record)))
+            count += 1
+
+    return count
@@ -62,10 +62,28 @@ def is_valid_mapping(mapped_vtx, mapped_nbhrs, target_graph):
     """
     if isinstance(target_graph, Graph):
         return all(target_graph.has_edge(mapped_vtx, vtx) for vtx in mapped_nbhrs)
+    elif hasattr(target_graph, 'is_valid_mapping'):
+        # Prepared by `static_target`
+        return target_graph.is_valid_mapping(mapped_vtx, mapped_nbhrs)
     else:
         # Assume that `target_graph` is the adjacency matrix
         return all(target_graph[mapped_vtx, vtx] for vtx in mapped_nbhrs)
 
+def predicted_node_work(node_type, bag_size, target_size):
+    r"""
+    Return the predicted work of a node, in DP table entries touched.
+
+    Intro and join nodes write one entry per mapping of their bag, forget
+    nodes read one entry per mapping of their child's bag.
+    """
+    match node_type:
+        case 'forget':
+            return target_size ** (bag_size + 1)
+        case 'intro' | 'join':
+            return target_size ** bag_size
+        case _:
+            return 1
+
 def count_occurrences(lst):
     r"""
     Count the occurrences of each element in `lst`
@@ -0,0 +1,186 @@
+r"""
+Opt-in memory profile of a count, from the engines' own accounting of their DP tables.
+
+A :class:`MemoryProfile` given to a count as ``memory=`` is told of every
+table the count computes and of every table it lets go, and keeps:
+
+- ``samples``, the time series of the bytes of the live tables: one sample per
+  table allocated, and one per group of tables released;
+- ``allocations``, the length and bytes of the table of every node;
+- ``peak_bytes`` and ``peak_node``, the most bytes live at once, and the node
+  whose table was just allocated then.
+
+Tables are counted with :func:`~helpers.tracing.table_bytes`, so tables of
+exact Python integers include every integer object. This is not the resident
+memory of the process: temporary arrays of the kernels, the target and the
+interpreter are not counted, nor are tables loaded from a checkpoint or an
+export.
+
+:class:`~standard_hom_count.GraphHomomorphismCounter` keeps every table until
+the count returns, so its live bytes only grow. The parallel engine releases
+a table once the node above it is computed: both are live while that node
+runs, then the children are released. Tasks running at the same time add up.
+Profile it with a threaded scheduler (Dask's default for delayed objects): a
+task run by another process, with the process scheduler or
+``dask.distributed``, raises ``RuntimeError`` rather than accounting into a
+copy of the profile that would never come back.
+
+:meth:`MemoryProfile.as_dict` returns everything as a JSON-serialisable
+dictionary, and :meth:`MemoryProfile.write_csv` writes the samples, one row
+each, ready to plot.
+"""
+import csv
+import os
+import threading
+import time
+
+from helpers.explain import _format_bytes
+from helpers.tracing import check_same_process, table_bytes
+
+
+# Tables popped by each instruction of a task program, see `helpers/task_specs.py`
+POPPED_TABLES = {'leaf': 0, 'intro': 1, 'forget': 1, 'join': 2}
+
+CSV_COLUMNS = ('seconds', 'live_bytes', 'event', 'node', 'type', 'bag_size', 'bytes')
+
+
+class MemoryProfile:
+    r"""
+    The live DP-table bytes of the profiled counts, over time.
+
+    EXAMPLES::
+
+        sage: from helpers.memory_profile import MemoryProfile
+        sage: memory = MemoryProfile()
+        sage: GraphHomomorphismCounter(graphs.CycleGraph(4), graphs.PetersenGraph()).count_homomorphisms(memory=memory)
+        150
+        sage: memory  # random
+        MemoryProfile: peak 1.7 KiB live at node 3 (intro, bag 3), 9 tables allocated
+        sage: memory.write_csv("memory.csv")  # not tested
+    """
+    def __init__(self):
+        self.samples = []
+        self.allocations = {}
+        self.live_bytes = 0
+        self.peak_bytes = 0
+        self.peak_node = None
+        self.origin_ns = time.perf_counter_ns()
+        self.pid = os.getpid()
+        self._lock = threading.Lock()
+
+    def __getstate__(self):
+        # Pickled into the tasks of other processes, which refuse it, see `profiled_task`
+        return {key: value for key, value in self.__dict__.items() if key != '_lock'}
+
+    def __setstate__(self, state):
+        self.__dict__.update(state, _lock=threading.Lock())
+
+    def __repr__(self):
+        peak = self.allocations.get(self.peak_node)
+        at = "" if peak is None else f" at node {self.peak_node} ({peak['type']}, bag {peak['bag_size']})"
+        return (f"MemoryProfile: peak {_format_bytes(self.peak_bytes)} live{at}, "
+                f"{len(self.allocations)} tables allocated")
+
+    def allocate(self, node_index, node_type, bag_size, table):
+        r"""
+        Record that the node ``node_index`` computed ``table``, which is now live.
+        """
+        num_bytes = table_bytes(table)
+        with self._lock:
+            self.allocations[node_index] = {'node': node_index, 'type': node_type, 'bag_size': bag_size,
+                                            'length': len(table), 'bytes': num_bytes}
+            self.live_bytes += num_bytes
+            if self.live_bytes > self.peak_bytes:
+                self.peak_bytes = self.live_bytes
+                self.peak_node = node_index
+            self._sample('allocate', node_index, node_type, bag_size, num_bytes)
+
+    def release(self, node_indices):
+        r"""
+        Record that the tables of the nodes ``node_indices`` are no longer live.
+
+        Nodes whose table was not allocated in this profile are ignored.
+        """
+        with self._lock:
+            released = [self.allocations[node_index] for node_index in node_indices
+                        if node_index in self.allocations]
+            if not released:
+                return
+            num_bytes = sum(allocation['bytes'] for allocation in released)
+            self.live_bytes -= num_bytes
+            self._sample('release', None, None, None, num_bytes)
+
+    def _sample(self, event, node_index, node_type, bag_size, num_bytes):
+        self.samples.append({
+            'seconds': (time.perf_counter_ns() - self.origin_ns) / 1e9,
+            'live_bytes': self.live_bytes,
+            'event': event,
+            'node': node_index,
+            'type': node_type,
+            'bag_size': bag_size,
+            'bytes': num_bytes,
+        })
+
+    def largest_allocations(self, limit=10):
+        r"""
+        Return the ``limit`` largest tables allocated, as dictionaries, the largest first.
+        """
+        return sorted(self.allocations.values(), key=lambda allocation: allocation['bytes'], reverse=True)[:limit]
+
+    def as_dict(self):
+        r"""
+        Return the profile as a JSON-serialisable dictionary.
+        """
+        peak = self.allocations.get(self.peak_node, {})
+        return {
+            'peak_bytes': self.peak_bytes,
+            'peak_node': self.peak_node,
+            'peak_type': peak.get('type'),
+            'peak_bag_size': peak.get('bag_size'),
+            'live_bytes': self.live_bytes,
+            'samples': list(self.samples),
+            'allocations': [self.allocations[node_index] for node_index in sorted(self.allocations)],
+        }
+
+    def write_csv(self, path):
+        r"""
+        Write the samples to ``path``, a CSV file with the columns ``CSV_COLUMNS``.
+
+        Release rows have no node, type or bag size; ``bytes`` is the size of
+        the tables allocated or released.
+        """
+        with open(path, 'w', newline='') as f:
+            writer = csv.DictWriter(f, CSV_COLUMNS)
+            writer.writeheader()
+            writer.writerows(self.samples)
+
+
+def profiled_task(memory, nodes, run_task, spec, *children_results, on_node=None):
+    r"""
+    Return ``run_task(spec, *children_results)``, recording the tables of the task in ``memory``.
+
+    ``nodes`` lists ``(node_index, node_type, bag_size)`` for every instruction of
+    the program of ``spec``, ``'input'`` instructions included, in order. The
+    tables popped by an instruction are released once its own table is
+    allocated. ``on_node``, if given, is called with every table as well, as
+    by :func:`~helpers.task_specs.run_task_spec`.
+    """
+    check_same_process(memory, "memory profile")
+    program = iter(zip(spec.program, nodes))
+    stack = []
+
+    def on_table(table):
+        instruction, node = next(program)
+        while instruction[0] == 'input':
+            stack.append(node[0])
+            instruction, node = next(program)
+
+        popped = [stack.pop() for _ in range(POPPED_TABLES[instruction[0]])]
+        memory.allocate(*node, table)
+        memory.release(popped)
+        stack.append(node[0])
+        if on_node is not None:
+            on_node(table)
+
+    return run_task(spec, *children_results, on_node=on_table)
+
@@ -0,0 +1,168 @@
+r"""
+Numba kernels of the parallel engine.
+
+The kernels are compiled once, at import, for the explicit signatures below,
+and cached on disk (``cache=True``), so that later imports, in this process or
+in any worker process, load the machine code instead of compiling it again.
+
+The tables are int64 arrays in the integer (mixed-radix) representation of
+`helpers/help_functions.py`; the engine only uses these kernels when every
+entry is known to fit in 64 bits, and exact Python integers otherwise.
+
+Run ``python -m helpers.numba_kernels`` once, e.g. when building a container
+image, to populate the cache ahead of time.
+"""
+import numpy as np
+from numba import njit, prange
+
+
+# Tables are int64, the adjacency matrix and the allowed images are uint8,
+# and sizes, strides and digit powers are int64
+INTRO_SIGNATURE = "int64[::1](int64[::1], int64, int64, int64[::1], int64[::1], uint8[:, ::1], uint8[::1], int64)"
+FORGET_SIGNATURE = "int64[::1](int64[::1], int64, int64, int64)"
+JOIN_SIGNATURE = "int64[::1](int64[::1], int64[::1])"
+
+# Bound on the number of homomorphisms for which int64 tables are exact
+INT64_TABLE_BOUND = 2 ** 63
+
+# Output entries per parallel chunk: 32K int64 entries, i.e. 256 KiB, so that
+# a chunk and the child entries it reads stay in a core's L2 cache
+CHUNK_SIZE = 1 << 15
+
+
+def fits_int64_tables(target_size, pattern_size):
+    r"""
+    Return whether every DP table entry fits in 64 bits.
+
+    An entry counts homomorphisms from a subgraph of the pattern, so it is
+    at most `|V(H)|^{|V(G)|}`.
+    """
+    return target_size ** pattern_size < INT64_TABLE_BOUND
+
+def intro_table(child, n, intro_index, nbr_positions, adjacency, allowed, chunk_size=CHUNK_SIZE):
+    r"""
+    Return the DP table of an intro node, see :func:`_intro_kernel`.
+    """
+    low_powers = np.array([n ** q for q in nbr_positions if q < intro_index], dtype=np.int64)
+    high_powers = np.array([n ** (q - intro_index) for q in nbr_positions if q >= intro_index], dtype=np.int64)
+    return _intro_kernel(child, n, n ** intro_index, low_powers, high_powers, adjacency, allowed, chunk_size)
+
+def forget_table(child, n, forgotten_index, chunk_size=CHUNK_SIZE):
+    r"""
+    Return the DP table of a forget node, see :func:`_forget_kernel`.
+    """
+    return _forget_kernel(child, n, n ** forgotten_index, chunk_size)
+
+def join_table(left, right):
+    r"""
+    Return the DP table of a join node, see :func:`_join_kernel`.
+    """
+    return _join_kernel(left, right)
+
+# The kernels split the output table into chunks of `chunk_size` consecutive
+# entries and hand the chunks to Numba's threads (`prange`). Every output
+# entry is written by exactly one chunk, summing in a fixed order, so the
+# result does not depend on the number of threads. With `nogil=True`, several
+# Dask threads can also run kernels at the same time.
+
+@njit(INTRO_SIGNATURE, cache=True, parallel=True, nogil=True)
+def _intro_kernel(child, n, low, low_powers, high_powers, adjacency, allowed, chunk_size):
+    r"""
+    Insert the intro vertex at the digit of weight ``low``.
+
+    ``low_powers`` (resp. ``high_powers``) are the weights, in the low (resp.
+    high) part of a child index, of the neighbours of the intro vertex.
+    """
+    high = child.shape[0] // low
+    out_length = low * n * high
+    out = np.zeros(out_length, dtype=np.int64)
+
+    # Validity of each image `x` against the neighbours among the low digits
+    low_valid = np.empty(n * low, dtype=np.uint8)
+    for x in prange(n):
+        for lo in range(low):
+            valid = allowed[x]
+            for q in range(low_powers.shape[0]):
+                valid &= adjacency[x, (lo // low_powers[q]) % n]
+            low_valid[x * low + lo] = valid
+
+    # Output block `t = hi * n + x` holds the mappings sending the intro
+    # vertex to `x`; a chunk may cover several blocks, or part of one
+    num_chunks = (out_length + chunk_size - 1) // chunk_size
+    for chunk in prange(num_chunks):
+        index = chunk * chunk_size
+        chunk_end = min(index + chunk_size, out_length)
+
+        while index < chunk_end:
+            t = index // low
+            block_end = min(chunk_end, (t + 1) * low)
+            hi, x = t // n, t % n
+
+            valid = np.uint8(1)
+            for q in range(high_powers.shape[0]):
+                valid &= adjacency[x, (hi // high_powers[q]) % n]
+
+            if valid:
+                for lo in range(index - t * low, block_end - t * low):
+                    out[t * low + lo] = child[hi * low + lo] * low_valid[x * low + lo]
+
+            index = block_end
+
+    return out
+
+@njit(FORGET_SIGNATURE, cache=True, parallel=True, nogil=True)
+def _forget_kernel(child, n, low, chunk_size):
+    r"""
+    Sum out the digit of weight ``low``.
+    """
+    high = child.shape[0] // (low * n)
+    out_length = low * high
+    out = np.zeros(out_length, dtype=np.int64)
+
+    num_chunks = (out_length + chunk_size - 1) // chunk_size
+    for chunk in prange(num_chunks):
+        index = chunk * chunk_size
+        chunk_end = min(index + chunk_size, out_length)
+
+        # Output entries sharing the high digits are contiguous
+        while index < chunk_end:
+            hi = index // low
+            block_end = min(chunk_end, (hi + 1) * low)
+
+            for x in range(n):
+                base = (hi * n + x) * low
+                for lo in range(index - hi * low, block_end - hi * low):
+                    out[hi * low + lo] += child[base + lo]
+
+            index = block_end
+
+    return out
+
+@njit(JOIN_SIGNATURE, cache=True, parallel=True, nogil=True)
+def _join_kernel(left, right):
+    out = np.empty_like(left)
+    for i in prange(left.shape[0]):
+        out[i] = left[i] * right[i]
+    return out
+
+
+def warm_up():
+    r"""
+    Make sure every kernel is compiled (or loaded from the cache) and initialised.
+
+    The kernels are compiled at import already; running each of them once
+    also starts Numba's threading layer. Use it as the initializer of worker
+    processes, e.g. ``ProcessPoolExecutor(initializer=warm_up)`` or
+    ``dask.distributed.Client.run(warm_up)``, so that they start hot.
+    """
+    child = np.ones(2, dtype=np.int64)
+    adjacency = np.array([[0, 1], [1, 0]], dtype=np.uint8)
+    allowed = np.ones(2, dtype=np.uint8)
+
+    table = intro_table(child, 2, 1, [0], adjacency, allowed)
+    table = join_table(table, table)
+    forget_table(table, 2, 0)
+
+
+if __name__ == "__main__":
+    warm_up()
@@ -0,0 +1,97 @@
+r"""
+Pattern plans: everything the DP needs that only depends on the pattern.
+
+Computing an optimal tree decomposition is the most expensive part of
+building a counter for a small pattern. A :class:`PatternPlan` holds it,
+with the nice tree decomposition derived from it, so that it can be computed
+once and shared by every counter of the same pattern, whatever the target::
+
+    sage: plan = PatternPlan(graphs.PetersenGraph())
+    sage: GraphHomomorphismCounter(plan.graph, graphs.CompleteGraph(3), plan=plan).count_homomorphisms()
+    0
+
+A plan may be *rooted* at a vertex of the pattern, which is then added to
+every bag of the decomposition (raising its width by at most one). The root
+vertex is thus forgotten on the path of forget nodes just below the root of
+the nice decomposition, and the table of the node right under that forget
+holds every homomorphism, by image of the root vertex; see
+:meth:`~standard_hom_count.GraphHomomorphismCounter.count_rooted_homomorphisms`.
+"""
+from sage.graphs.graph import Graph
+from sage.sets.set import Set
+
+from helpers.nice_tree_decomp import *
+from helpers.help_functions import node_changes
+
+
+class PatternPlan:
+    r"""
+    The nice tree decomposition of a pattern graph.
+
+    INPUT:
+
+    - ``graph`` -- a Sage graph, the pattern
+
+    - ``root_vertex`` (default: None) -- a vertex of ``graph`` kept in every bag, for rooted counts
+    """
+    def __init__(self, graph, root_vertex=None):
+        self.graph = graph
+        self.root_vertex = root_vertex
+        self.tree_decomp = graph.treewidth(certificate=True)
+        if root_vertex is not None:
+            if not graph.has_vertex(root_vertex):
+                raise ValueError(f"the root vertex {root_vertex!r} is not a vertex of the pattern")
+            self.tree_decomp = rooted_tree_decomposition(self.tree_decomp, root_vertex)
+        self.nice_tree_decomp = make_nice_tree_decomposition(graph, self.tree_decomp)
+        self.root = sorted(self.nice_tree_decomp)[0]
+
+        # Make it into directed graph for better access
+        # to children and parent, if needed
+        #
+        # Each node in a labelled nice tree decomposition
+        # has the following form:
+        #
+        # (node_index, bag_vertices) node_type
+        #
+        # Example: (5, {0, 4}) intro
+        self.dir_labelled_TD = label_nice_tree_decomposition(self.nice_tree_decomp, self.root, directed=True)
+
+        # `node_changes_dict` is responsible for recording introduced and
+        # forgotten vertices in a nice tree decomposition
+        self.node_changes_dict = node_changes(self.dir_labelled_TD)
+
+    def __repr__(self):
+        rooted = "" if self.root_vertex is None else f" rooted at {self.root_vertex!r}"
+        return f"Pattern plan of {self.graph}{rooted} with {len(self.dir_labelled_TD)} nodes"
+
+
+def rooted_tree_decomposition(tree_decomp, root_vertex):
+    r"""
+    Return the tree decomposition ``tree_decomp`` with ``root_vertex`` added to every bag.
+
+    Adding a vertex may make a bag a subset of a neighbouring bag; such bags
+    are merged into their neighbour, so that the bags stay pairwise distinct.
+    """
+    bags = {node: Set(node).union(Set([root_vertex])) for node in tree_decomp}
+    neighbours = {node: set(tree_decomp.neighbors(node)) for node in tree_decomp}
+
+    merged = True
+    while merged:
+        merged = False
+        for node in list(neighbours):
+            into = next((other for other in neighbours[node] if bags[node].issubset(bags[other])), None)
+            if into is None:
+                continue
+
+            # Contract the edge, keeping the larger bag
+            for other in neighbours.pop(node):
+                neighbours[other].discard(node)
+                if other != into:
+                    neighbours[other].add(into)
+                    neighbours[into].add(other)
+            merged = True
+
+    rooted = Graph(name=f"Rooted {tree_decomp.name()}")
+    rooted.add_vertices([bags[node] for node in neighbours])
+    rooted.add_edges((bags[node], bags[other]) for node in neighbours for other in neighbours[node])
+    return rooted
@@ -0,0 +1,300 @@
+import numpy as np
+
+
+class PreparedTarget:
+    r"""
+    A target graph in the compact form consumed by the counting engines.
+
+    The vertices are the integers `0, 1, ..., n - 1`, and the edges are kept
+    as a symmetric CSR (compressed sparse row) structure: the neighbours of
+    `u` are ``indices[indptr[u]:indptr[u + 1]]``, sorted increasingly.
+
+    Instances behave enough like a Sage graph for the engines: ``len()``,
+    iteration over vertices, ``density()``, ``has_edge()``,
+    ``adjacency_matrix()`` and ``target[u, v]`` are all supported.
+
+    INPUT:
+
+    - ``num_vertices`` -- an integer, the number of vertices `n`
+
+    - ``indptr`` -- an integer array of length `n + 1`
+
+    - ``indices`` -- an integer array of length ``indptr[n]``
+
+    - ``name`` (default: None) -- an optional name, e.g. the source file and line
+
+    EXAMPLES::
+
+        sage: from helpers.prepared_target import PreparedTarget
+        sage: triangle = PreparedTarget.from_edges(3, [(0, 1), (1, 2), (0, 2)])
+        sage: len(triangle), triangle.num_edges, triangle[0, 2]
+        (3, 3, True)
+    """
+    def __init__(self, num_vertices, indptr, indices, name=None):
+        self.num_vertices = int(num_vertices)
+        self.indptr = np.asarray(indptr, dtype=np.int64)
+        self.indices = np.asarray(indices, dtype=np.int32)
+        self.num_edges = len(self.indices) // 2
+        self.name = name
+
+        if len(self.indptr) != self.num_vertices + 1:
+            raise ValueError("indptr must have length num_vertices + 1")
+
+        # Bitset rows (one Python integer per vertex) for dense targets,
+        # neighbour sets for sparse ones, and the adjacency matrix of the
+        # compiled kernels, each built on first use
+        self._rows = None
+        self._neighbour_sets = None
+        self._adjacency = None
+
+    @classmethod
+    def from_edges(cls, num_vertices, edges, name=None):
+        r"""
+        Return the prepared target on ``num_vertices`` vertices with the given edges.
+
+        Each undirected edge must be given once; loops and multiple edges
+        are rejected, as the engines only handle simple graphs.
+        """
+        edges = np.asarray(edges, dtype=np.int64).reshape(-1, 2)
+        return cls._from_edge_array(num_vertices, edges[:, 0], edges[:, 1], name)
+
+    @classmethod
+    def from_graph(cls, graph, name=None):
+        r"""
+        Return the prepared target of the Sage graph ``graph``.
+
+        The vertices of ``graph`` must be `0, 1, ..., n - 1`.
+        """
+        edges = [(u, v) for u, v, _ in graph.edge_iterator()]
+        return cls.from_edges(len(graph), edges, name=name)
+
+    @classmethod
+    def _from_edge_array(cls, num_vertices, heads, tails, name=None):
+        if len(heads) and (heads == tails).any():
+            raise ValueError("target graph must be simple (no loops)")
+
+        # Store both directions, sorted by (source, destination)
+        sources = np.concatenate((heads, tails))
+        destinations = np.concatenate((tails, heads))
+        order = np.lexsort((destinations, sources))
+        sources, destinations = sources[order], destinations[order]
+
+        if len(sources) > 1:
+            same = (sources[1:] == sources[:-1]) & (destinations[1:] == destinations[:-1])
+            if same.any():
+                raise ValueError("target graph must be simple (no multiple edges)")
+
+        indptr = np.zeros(num_vertices + 1, dtype=np.int64)
+        np.cumsum(np.bincount(sources, minlength=num_vertices), out=indptr[1:])
+
+        return cls(num_vertices, indptr, destinations, name=name)
+
+    ### Sage-like graph interface used by the engines
+
+    def __len__(self):
+        return self.num_vertices
+
+    def __iter__(self):
+        return iter(range(self.num_vertices))
+
+    def __repr__(self):
+        name = f"{self.name}: " if self.name else ""
+        return f"{name}Prepared target on {self.num_vertices} vertices and {self.num_edges} edges"
+
+    def density(self):
+        n = self.num_vertices
+        if n < 2:
+            return 0
+        return self.num_edges / (n * (n - 1) / 2)
+
+    def neighbors(self, u):
+        return self.indices[self.indptr[u]:self.indptr[u + 1]]
+
+    def degree(self, u):
+        return int(self.indptr[u + 1] - self.indptr[u])
+
+    def has_edge(self, u, v):
+        return v in self.neighbour_sets()[u]
+
+    def __getitem__(self, edge):
+        u, v = edge
+        return self.has_edge(u, v)
+
+    def is_valid_mapping(self, mapped_vtx, mapped_nbhrs):
+        r"""
+        Check if ``mapped_vtx`` is adjacent to all of ``mapped_nbhrs``.
+        """
+        return self.is_valid_masked(mapped_vtx, self.neighbour_mask(mapped_nbhrs))
+
+    def neighbour_mask(self, mapped_nbhrs):
+        r"""
+        Return ``mapped_nbhrs`` in the form taken by :meth:`is_valid_masked`, here a tuple.
+
+        The intro nodes check every target vertex against the same mapped
+        neighbours, so they build the mask once per child mapping.
+        """
+        return tuple(mapped_nbhrs)
+
+    def is_valid_masked(self, mapped_vtx, mask):
+        r"""
+        Check if ``mapped_vtx`` is adjacent to all of the vertices of ``mask``, see :meth:`neighbour_mask`.
+        """
+        nbhs = self.neighbour_sets()[mapped_vtx]
+        return all(vtx in nbhs for vtx in mask)
+
+    def neighbour_sets(self):
+        r"""
+        Return the neighbourhoods as a list of frozensets.
+        """
+        if self._neighbour_sets is None:
+            self._neighbour_sets = [frozenset(self.neighbors(u).tolist()) for u in self]
+        return self._neighbour_sets
+
+    def bitset_rows(self):
+        r"""
+        Return the adjacency rows as Python integers, bit `v` of row `u` being `uv`.
+        """
+        if self._rows is None:
+            rows = []
+            for u in range(self.num_vertices):
+                row = 0
+                for v in self.neighbors(u).tolist():
+                    row |= 1 << v
+                rows.append(row)
+            self._rows = rows
+        return self._rows
+
+    def adjacency_matrix(self):
+        r"""
+        Return the dense adjacency matrix as a boolean numpy array, built on first use and not to be modified.
+        """
+        if self._adjacency is None:
+            matrix = np.zeros((self.num_vertices, self.num_vertices), dtype=np.bool_)
+            sources = np.repeat(np.arange(self.num_vertices), np.diff(self.indptr))
+            matrix[sources, self.indices] = True
+            self._adjacency = matrix
+        return self._adjacency
+
+    def to_sage_graph(self):
+        r"""
+        Return a Sage graph isomorphic (in fact equal) to this target.
+        """
+        from sage.graphs.graph import Graph
+
+        return Graph({u: self.neighbors(u).tolist() for u in self}, name=self.name)
+
+    def __getstate__(self):
+        # The bitset rows are a cache, rebuilt on demand in the worker
+        state = self.__dict__.copy()
+        state['_rows'] = None
+        state['_neighbour_sets'] = None
+        state['_adjacency'] = None
+        return state
+
+
+class BitsetTarget:
+    r"""
+    A dense target graph as one bitset (a Python integer) per vertex.
+
+    Checking that a vertex is adjacent to all the vertices of a set is then a
+    single ``&`` over machine words, done in C by the integer implementation.
+    """
+    def __init__(self, rows):
+        self.rows = rows
+
+    def has_edge(self, u, v):
+        return bool(self.rows[u] >> v & 1)
+
+    def is_valid_mapping(self, mapped_vtx, mapped_nbhrs):
+        return self.is_valid_masked(mapped_vtx, self.neighbour_mask(mapped_nbhrs))
+
+    def neighbour_mask(self, mapped_nbhrs):
+        r"""
+        Return the bitset of ``mapped_nbhrs``, see :meth:`PreparedTarget.neighbour_mask`.
+        """
+        mask = 0
+        for vtx in mapped_nbhrs:
+            mask |= 1 << vtx
+        return mask
+
+    def is_valid_masked(self, mapped_vtx, mask):
+        return self.rows[mapped_vtx] & mask == mask
+
+
+def static_target(target_graph, density_threshold=0.5):
+    r"""
+    Convert ``target_graph`` once to the representation used for the intro validity checks.
+
+    INPUT:
+
+    - ``target_graph`` -- a Sage graph or a :class:`PreparedTarget`, on vertices `0, ..., n - 1`
+
+    - ``density_threshold`` (default: 0.5) -- targets at least this dense become a
+      :class:`BitsetTarget`; sparser Sage graphs become a :class:`PreparedTarget`,
+      whose checks look vertices up in frozensets, and sparser prepared targets
+      are used as they are
+
+    OUTPUT:
+
+    - an object with methods ``has_edge(u, v)``, ``is_valid_mapping(mapped_vtx, mapped_nbhrs)``,
+      and ``neighbour_mask(mapped_nbhrs)`` and ``is_valid_masked(mapped_vtx, mask)``
+      to check many vertices against the same neighbours
+    """
+    if target_graph.density() >= density_threshold:
+        if isinstance(target_graph, PreparedTarget):
+            return BitsetTarget(target_graph.bitset_rows())
+
+        rows = []
+        for u in target_graph:
+            row = 0
+            for v in target_graph.neighbor_iterator(u):
+                row |= 1 << v
+            rows.append(row)
+        return BitsetTarget(rows)
+
+    if isinstance(target_graph, PreparedTarget):
+        return target_graph
+    return PreparedTarget.from_graph(target_graph)
+
+
+class ConvertedTarget:
+    r"""
+    A target graph together with its conversions for the engines, made once and shared by counters.
+
+    Counting many patterns in the same target, give every
+    :class:`~standard_hom_count.GraphHomomorphismCounter` this object as
+    ``converted``, so that the representation of the validity checks and the
+    adjacency matrix of the compiled kernels are only built once.
+
+    INPUT:
+
+    - ``target_graph`` -- a Sage graph or a :class:`PreparedTarget`
+
+    - ``density_threshold`` (default: 0.5) -- as for :func:`static_target`
+    """
+    def __init__(self, target_graph, density_threshold=0.5):
+        self.target_graph = target_graph
+        self.density_threshold = density_threshold
+        self.target = static_target(target_graph, density_threshold)
+        self._kernel_adjacency = None
+
+    def kernel_adjacency(self):
+        r"""
+        Return :func:`dense_adjacency` of the target, built on first use.
+        """
+        if self._kernel_adjacency is None:
+            self._kernel_adjacency = dense_adjacency(self.target_graph)
+        return self._kernel_adjacency
+
+
+def dense_adjacency(target_graph):
+    r"""
+    Return the adjacency matrix of ``target_graph`` as a C-contiguous uint8 numpy array.
+    """
+    if isinstance(target_graph, PreparedTarget):
+        return target_graph.adjacency_matrix().view(np.uint8)
+
+    matrix = np.zeros((len(target_graph), len(target_graph)), dtype=np.uint8)
+    for u, v, _ in target_graph.edge_iterator():
+        matrix[u, v] = matrix[v, u] = 1
+    return matrix
@@ -0,0 +1,171 @@
+r"""
+A persistent cache of counts, in a SQLite database.
+
+A count is keyed by the hashes of the canonical forms of the pattern and of
+the target, with their colours when the count is colourful, and by the mode
+of the count (``'hom'``, ``'colourful'`` or ``'subgraph'``): isomorphic
+pairs of graphs share their entry, whatever the order of their vertices.
+
+Canonical forms are computed by Sage's ``canonical_label``; for a coloured
+graph, the colour classes, ordered by colour, form the partition the
+labelling must respect, and the colours of the canonical vertices are part
+of the hash. Computing a canonical form is usually much cheaper than a
+count, but not free: hash each pattern once with :func:`canonical_hash`, and
+use the batch methods of :class:`ResultCache`, to pre-filter many pairs at once.
+
+Counts are stored as decimal strings, so they are exact. Several processes
+may share a database: it uses SQLite's write-ahead log, and a cache pickles
+as its path only.
+"""
+import hashlib
+import sqlite3
+
+from helpers.prepared_target import PreparedTarget
+
+
+MODES = ('hom', 'colourful', 'subgraph')
+
+# Number of keys per batch query, within SQLite's limit of bound parameters
+BATCH_SIZE = 256
+
+
+def canonical_hash(graph, colours=None):
+    r"""
+    Return the SHA-256 of the canonical form of ``graph``, coloured by ``colours`` if given.
+
+    INPUT:
+
+    - ``graph`` -- a Sage graph or a :class:`~helpers.prepared_target.PreparedTarget`
+
+    - ``colours`` (default: None) -- a list of the colours of the vertices of ``graph``, indexed by vertex
+
+    EXAMPLES::
+
+        sage: from helpers.result_cache import canonical_hash
+        sage: canonical_hash(graphs.PathGraph(3)) == canonical_hash(Graph([(0, 2), (2, 1)]))
+        True
+        sage: canonical_hash(graphs.PathGraph(3), [0, 1, 0]) == canonical_hash(graphs.PathGraph(3), [1, 0, 0])
+        False
+    """
+    if isinstance(graph, PreparedTarget):
+        graph = graph.to_sage_graph()
+
+    if colours is None:
+        form = graph.canonical_label().graph6_string()
+    else:
+        classes = sorted({colours[vertex] for vertex in graph})
+        partition = [[vertex for vertex in graph if colours[vertex] == colour] for colour in classes]
+        canonical, relabelling = graph.canonical_label(partition=partition, certificate=True)
+        canonical_colours = [None] * len(graph)
+        for vertex, label in relabelling.items():
+            canonical_colours[label] = colours[vertex]
+        form = canonical.graph6_string() + ":" + ",".join(map(repr, canonical_colours))
+
+    return hashlib.sha256(form.encode()).hexdigest()
+
+
+class ResultCache:
+    r"""
+    Counts in the SQLite database ``path``, created if needed.
+
+    A key is a tuple ``(pattern_hash, target_hash, mode)``, see :meth:`key`.
+
+    EXAMPLES::
+
+        sage: from helpers.result_cache import ResultCache
+        sage: cache = ResultCache("counts.sqlite")  # not tested
+        sage: counter = GraphHomomorphismCounter(graphs.CycleGraph(4), graphs.PetersenGraph(), cache=cache)  # not tested
+        sage: counter.count_homomorphisms()  # not tested, counted and stored
+        150
+        sage: GraphHomomorphismCounter(graphs.CycleGraph(4), graphs.PetersenGraph(), cache=cache).count_homomorphisms()  # not tested, read back
+        150
+    """
+    def __init__(self, path):
+        self.path = path
+        self._connection = None
+
+    def __getstate__(self):
+        # Worker processes open their own connection
+        return {'path': self.path}
+
+    def __setstate__(self, state):
+        self.__init__(state['path'])
+
+    @property
+    def connection(self):
+        if self._connection is None:
+            self._connection = sqlite3.connect(self.path, timeout=60)
+            self._connection.execute("PRAGMA journal_mode=WAL")
+            self._connection.execute("CREATE TABLE IF NOT EXISTS counts (pattern TEXT, target TEXT, mode TEXT, "
+                                     "count TEXT, PRIMARY KEY (pattern, target, mode)) WITHOUT ROWID")
+            self._connection.commit()
+        return self._connection
+
+    def close(self):
+        if self._connection is not None:
+            self._connection.close()
+            self._connection = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc_info):
+        self.close()
+
+    def __len__(self):
+        return self.connection.execute("SELECT COUNT(*) FROM counts").fetchone()[0]
+
+    @staticmethod
+    def key(graph, target_graph, mode='hom', graph_clr=None, target_clr=None):
+        r"""
+        Return the key of the count of ``graph`` in ``target_graph`` in mode ``mode``.
+
+        The colours are only used in the ``'colourful'`` mode. Either graph may
+        also be given by its hash, a string returned by :func:`canonical_hash`
+        (with the colours of the count, in the ``'colourful'`` mode).
+        """
+        if mode not in MODES:
+            raise ValueError(f"mode must be one of {MODES}")
+        colourful = mode == 'colourful'
+
+        pattern_hash = graph if isinstance(graph, str) else canonical_hash(graph, graph_clr if colourful else None)
+        target_hash = (target_graph if isinstance(target_graph, str)
+                       else canonical_hash(target_graph, target_clr if colourful else None))
+        return pattern_hash, target_hash, mode
+
+    def get(self, key):
+        r"""
+        Return the count of ``key``, or None if it is not cached.
+        """
+        row = self.connection.execute("SELECT count FROM counts WHERE pattern = ? AND target = ? AND mode = ?",
+                                      key).fetchone()
+        return None if row is None else int(row[0])
+
+    def put(self, key, count):
+        r"""
+        Store ``count`` as the count of ``key``.
+        """
+        self.put_many([(key, count)])
+
+    def get_many(self, keys):
+        r"""
+        Return a dictionary from the cached keys among ``keys`` to their counts.
+        """
+        keys = list(dict.fromkeys(keys))
+        found = {}
+        for start in range(0, len(keys), BATCH_SIZE):
+            batch = keys[start:start + BATCH_SIZE]
+            rows = self.connection.execute(
+                "SELECT pattern, target, mode, count FROM counts WHERE (pattern, target, mode) IN "
+                f"(VALUES {', '.join(['(?, ?, ?)'] * len(batch))})",
+                [part for key in batch for part in key])
+            found.update(((pattern, target, mode), int(count)) for pattern, target, mode, count in rows)
+        return found
+
+    def put_many(self, items):
+        r"""
+        Store the counts of ``items``, pairs ``(key, count)``, in one transaction.
+        """
+        with self.connection:
+            self.connection.executemany("INSERT OR REPLACE INTO counts VALUES (?, ?, ?, ?)",
+                                        [(*key, str(int(count))) for key, count in items])
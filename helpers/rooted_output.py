@@ -0,0 +1,139 @@
+r"""
+Streaming outputs for rooted counts, one block of target vertices at a time.
+
+:meth:`~standard_hom_count.GraphHomomorphismCounter.iter_rooted_homomorphisms`
+yields ``(start, counts)`` blocks, where ``counts`` is a numpy array (int64
+when exact, else object) of the counts of the target vertices ``start``,
+``start + 1``, ... A block is written by :func:`write_rooted_block` to:
+
+- a numpy array, typically a memory map (``np.memmap`` or
+  ``np.lib.format.open_memmap``) of one entry per target vertex: counts are
+  stored natively, e.g. as int64 or uint64, or reduced modulo a modulus;
+- a :class:`VarintBlobWriter`, for exact counts of any size.
+
+A varint blob file holds every count as its minimal little-endian bytes (0
+bytes for 0), indexed by offsets::
+
+    b"HOMVAR01"                   magic, 8 bytes
+    n, offsets_start              2 x int64, little-endian
+    blob                          the bytes of the counts, in vertex order
+    offsets                       (n + 1) x uint64 at offsets_start, the
+                                  count of v being blob[offsets[v]:offsets[v + 1]]
+
+The offsets come last, so the blob is written as the blocks arrive, and
+:class:`VarintBlob` reads any count from a memory map of the file.
+"""
+import mmap
+import os
+
+import numpy as np
+
+
+VARINT_MAGIC = b"HOMVAR01"
+_HEADER_SIZE = len(VARINT_MAGIC) + 16
+
+# Target vertices per block of rooted counts
+ROOTED_BLOCK_SIZE = 1 << 14
+
+
+def write_rooted_block(out, start, counts, modulus=None):
+    r"""
+    Write the block of rooted counts ``counts``, of the target vertices from ``start``, to ``out``.
+
+    INPUT:
+
+    - ``out`` -- a numpy array (e.g. a memory map) with an entry per target
+      vertex, or a :class:`VarintBlobWriter`
+
+    - ``start`` -- the first target vertex of the block
+
+    - ``counts`` -- a numpy array of nonnegative integers
+
+    - ``modulus`` (default: None) -- if given, the counts are stored modulo ``modulus``
+
+    Storing a count too large for the dtype of ``out`` raises ``OverflowError``.
+    """
+    if modulus is not None:
+        counts = counts % modulus
+
+    if isinstance(out, VarintBlobWriter):
+        out.write(start, counts)
+        return
+
+    if out.dtype.kind in 'iu' and len(counts) and counts.max() > np.iinfo(out.dtype).max:
+        raise OverflowError(f"a rooted count exceeds the range of {out.dtype}, use a modulus or a varint blob")
+    out[start:start + len(counts)] = counts
+
+
+class VarintBlobWriter:
+    r"""
+    Write the exact counts of ``num_vertices`` target vertices to the varint blob file ``path``.
+
+    Blocks must be written in vertex order; :meth:`close` writes the offsets.
+    Use it as a context manager.
+    """
+    def __init__(self, path, num_vertices):
+        self.path = path
+        self.num_vertices = num_vertices
+        self.offsets = np.zeros(num_vertices + 1, dtype=np.uint64)
+        self.next_vertex = 0
+        self.file = open(path, 'wb')
+        self.file.write(bytes(_HEADER_SIZE))
+
+    def write(self, start, counts):
+        if start != self.next_vertex:
+            raise ValueError(f"expected the block of vertex {self.next_vertex}, got {start}")
+
+        chunks = [int(count).to_bytes((int(count).bit_length() + 7) // 8, 'little') for count in counts]
+        self.offsets[start + 1:start + len(chunks) + 1] = self.offsets[start] + np.cumsum(
+            [len(chunk) for chunk in chunks], dtype=np.uint64)
+        self.file.write(b"".join(chunks))
+        self.next_vertex += len(chunks)
+
+    def close(self):
+        if self.file.closed:
+            return
+        if self.next_vertex != self.num_vertices:
+            self.file.close()
+            raise ValueError(f"only {self.next_vertex} of {self.num_vertices} counts were written")
+
+        offsets_start = self.file.tell()
+        self.file.write(self.offsets.astype('<u8').tobytes())
+        self.file.seek(0)
+        self.file.write(VARINT_MAGIC + np.array([self.num_vertices, offsets_start], dtype='<i8').tobytes())
+        self.file.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, *exc_info):
+        if exc_type is None:
+            self.close()
+        else:
+            self.file.close()
+
+
+class VarintBlob:
+    r"""
+    The counts of the varint blob file ``path``, read from a memory map.
+
+    ``blob[v]`` is the count of the target vertex ``v``; iterating yields every count.
+    """
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) if os.path.getsize(path) else b""
+
+        if self.data[:len(VARINT_MAGIC)] != VARINT_MAGIC:
+            raise ValueError(f"{path} is not a varint blob file")
+        num_vertices, offsets_start = np.frombuffer(self.data, dtype='<i8', count=2, offset=len(VARINT_MAGIC))
+        self.offsets = np.frombuffer(self.data, dtype='<u8', count=num_vertices + 1, offset=offsets_start)
+
+    def __len__(self):
+        return len(self.offsets) - 1
+
+    def __getitem__(self, vertex):
+        start, end = int(self.offsets[vertex]), int(self.offsets[vertex + 1])
+        return int.from_bytes(self.data[_HEADER_SIZE + start:_HEADER_SIZE + end], 'little')
+
+    def __iter__(self):
+        return (self[vertex] for vertex in range(len(self)))
@@ -0,0 +1,51 @@
+r"""
+Image-pinned sharding of a single count.
+
+A homomorphism sends a chosen pattern vertex `v` to exactly one target
+vertex, so partitioning the target vertices into shards `S_1, ..., S_s` and
+counting, for each shard, the homomorphisms sending `v` into it splits the
+count into `s` independent counts, whose sum is exact. Each shard is a full
+DP in which the images of `v` are restricted to the shard (see ``domain`` in
+`helpers/task_specs.py`), so shards never communicate until the final sum.
+
+The cost of a shard is estimated by its degree-weighted size: sending `v` to
+a target vertex `x` leaves about `(deg(x) + 1)^{deg(v)}` choices for the
+neighbours of `v`.
+"""
+import heapq
+
+
+def pinned_vertex_choice(graph):
+    r"""
+    Return the vertex of ``graph`` to pin: one of maximum degree, which splits the work the most evenly.
+    """
+    return max(graph, key=graph.degree)
+
+def image_weights(target_degrees, pinned_degree):
+    r"""
+    Return the estimated cost of sending a pattern vertex of degree ``pinned_degree`` to each target vertex.
+    """
+    return [float(degree + 1) ** pinned_degree for degree in target_degrees]
+
+def balanced_shards(vertices, weights, num_shards):
+    r"""
+    Partition ``vertices`` into at most ``num_shards`` shards of balanced total weight.
+
+    This is the greedy longest-processing-time rule: vertices by decreasing
+    weight, each to the currently lightest shard. Empty shards are dropped,
+    and each shard is sorted.
+
+    EXAMPLES::
+
+        sage: balanced_shards(range(5), [5, 1, 4, 2, 3], 2)
+        [[0, 1, 3], [2, 4]]
+    """
+    heap = [(0.0, shard) for shard in range(num_shards)]
+    shards = [[] for _ in range(num_shards)]
+
+    for vertex in sorted(vertices, key=lambda vertex: -weights[vertex]):
+        load, shard = heapq.heappop(heap)
+        shards[shard].append(vertex)
+        heapq.heappush(heap, (load + weights[vertex], shard))
+
+    return [sorted(shard) for shard in shards if shard]
@@ -0,0 +1,166 @@
+r"""
+DP tables in shared memory, for the multi-process backend of the parallel engine.
+
+With process-based schedulers, returning a table from a task pickles it, and
+passing it to the next task unpickles it again in another process: two full
+copies per table. Instead, a task run by :func:`run_shared_task_spec` writes
+its table to a `multiprocessing.shared_memory` segment (in ``/dev/shm`` on
+Linux) and only returns a :class:`SharedTable` handle, i.e. the segment name
+and the table length. The task consuming it maps the segment and reads the
+table in place; joins thus read both children without any copy.
+
+Every table of a tree decomposition is read by exactly one task, its parent,
+so a segment has a single reference: the consumer unlinks it as soon as its
+own table is written. Tables of exact Python integers (dtype 'object') cannot
+live in shared memory and are passed as they are.
+
+The functions run under Dask's local process scheduler, under any scheduler
+in fact, and :func:`run_in_process_pool` is a small scheduler of its own on
+top of `concurrent.futures.ProcessPoolExecutor`.
+"""
+from collections import namedtuple
+from concurrent.futures import FIRST_COMPLETED, ProcessPoolExecutor, wait
+import multiprocessing
+from multiprocessing import shared_memory
+
+import numpy as np
+
+from helpers.numba_kernels import warm_up
+from helpers.task_specs import run_task_spec
+
+
+# A table of `length` int64 entries in the shared memory segment `name`
+SharedTable = namedtuple('SharedTable', ['name', 'length'])
+
+
+def share_table(table):
+    r"""
+    Copy the int64 array ``table`` to a new shared memory segment and return its handle.
+    """
+    # Segments cannot be empty
+    segment = shared_memory.SharedMemory(create=True, size=max(table.nbytes, 1))
+    try:
+        np.ndarray(len(table), dtype=np.int64, buffer=segment.buf)[:] = table
+    finally:
+        segment.close()
+    return SharedTable(segment.name, len(table))
+
+def attach_table(handle):
+    r"""
+    Return ``(segment, table)``, where ``table`` is a view, without copy, of the table of ``handle``.
+
+    Close the segment (after dropping every view of it) with :func:`release_table`.
+    """
+    segment = shared_memory.SharedMemory(name=handle.name)
+    return segment, np.ndarray(handle.length, dtype=np.int64, buffer=segment.buf)
+
+def release_table(segment):
+    r"""
+    Close and unlink ``segment``, whose table has been consumed.
+    """
+    segment.close()
+    segment.unlink()
+
+def fetch_shared_table(table):
+    r"""
+    Return a private copy of a table returned by :func:`run_shared_task_spec`, releasing its segment.
+    """
+    if not isinstance(table, SharedTable):
+        return table
+
+    segment, view = attach_table(table)
+    result = view.copy()
+    del view
+    release_table(segment)
+    return result
+
+def run_shared_task_spec(spec, *children_tables):
+    r"""
+    Run :func:`~helpers.task_specs.run_task_spec` with the tables in shared memory.
+
+    ``children_tables`` are the handles returned by the tasks this one depends
+    on; their segments are unlinked once the table of this task is written.
+    Return the handle of that table, or the table itself for dtype 'object'.
+    """
+    if spec.dtype != 'int64':
+        return run_task_spec(spec, *children_tables)
+
+    segments, children = [], []
+    try:
+        for handle in children_tables:
+            segments.append(shared_memory.SharedMemory(name=handle.name))
+            children.append(np.ndarray(handle.length, dtype=np.int64, buffer=segments[-1].buf))
+
+        result = share_table(run_task_spec(spec, *children))
+    finally:
+        # Views must be dropped before their segment can be closed
+        del children
+        for segment in segments:
+            release_table(segment)
+
+    return result
+
+def run_in_process_pool(specs, children, max_workers=None):
+    r"""
+    Run a task graph on a pool of worker processes, with tables in shared memory.
+
+    INPUT:
+
+    - ``specs`` -- the :class:`~helpers.task_specs.TaskSpec` of each task
+
+    - ``children`` -- for each task, the indices of the tasks it depends on;
+      every task but the first (the root) has exactly one parent
+
+    - ``max_workers`` (default: None) -- the number of worker processes, by
+      default the number of cores
+
+    OUTPUT: the table of the first task, as a numpy array
+
+    A task is submitted as soon as all its children are done, so independent
+    subtrees run at the same time. Workers start with the Numba kernels loaded.
+    """
+    parent = {child: task for task in range(len(specs)) for child in children[task]}
+    waiting = [len(children[task]) for task in range(len(specs))]
+    results = {}
+    running = {}
+
+    # Forking would copy the parent's Numba threads in an unusable state
+    context = multiprocessing.get_context('spawn')
+
+    with ProcessPoolExecutor(max_workers=max_workers, mp_context=context, initializer=warm_up) as pool:
+        def submit(task):
+            inputs = [results.pop(child) for child in children[task]]
+            running[pool.submit(run_shared_task_spec, specs[task], *inputs)] = (task, inputs)
+
+        try:
+            for task in range(len(specs)):
+                if not waiting[task]:
+                    submit(task)
+
+            while running:
+                done, _ = wait(running, return_when=FIRST_COMPLETED)
+                for future in done:
+                    task, _ = running.pop(future)
+                    results[task] = future.result()
+
+                    if task in parent:
+                        waiting[parent[task]] -= 1
+                        if not waiting[parent[task]]:
+                            submit(parent[task])
+        except BaseException:
+            # Release the segments that no task is left to consume: the
+            # outputs of finished tasks and the inputs of cancelled ones
+            for future in running:
+                future.cancel()
+            wait(running)
+            unconsumed = list(results.values())
+            for future, (_, inputs) in running.items():
+                if future.cancelled():
+                    unconsumed.extend(inputs)
+                elif future.exception() is None:
+                    unconsumed.append(future.result())
+            for table in unconsumed:
+                fetch_shared_table(table)
+            raise
+
+    return fetch_shared_table(results[0])
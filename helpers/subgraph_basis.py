@@ -0,0 +1,89 @@
+r"""
+Subgraph counts as linear combinations of homomorphism counts.
+
+The number of subgraphs (not necessarily induced) of `G` isomorphic to `H` is
+`\mathrm{sub}(H, G) = \mathrm{inj}(H, G) / |\mathrm{Aut}(H)|`, and by
+inclusion–exclusion over the partitions `\rho` of `V(H)`,
+
+.. MATH::
+
+    \mathrm{inj}(H, G) = \sum_{\rho} \mu(\rho) \, \mathrm{hom}(H / \rho, G),
+    \qquad \mu(\rho) = \prod_{B \in \rho} (-1)^{|B| - 1} (|B| - 1)!,
+
+where `H / \rho` merges every block of `\rho` into one vertex. A quotient
+merging the ends of an edge has a loop, hence no homomorphism to a simple
+graph, so only partitions into independent sets are kept. Grouping the
+isomorphic quotients gives the basis of [CDM2017]_: the graphs of the spasm
+of `H`, each with a rational coefficient.
+"""
+from fractions import Fraction
+from math import factorial
+
+from sage.graphs.graph import Graph
+
+
+def subgraph_basis(graph):
+    r"""
+    Return the pairs ``(quotient, coefficient)`` such that `\mathrm{sub}(H, G) = \sum` ``coefficient`` `\cdot \mathrm{hom}(` ``quotient`` `, G)`.
+
+    INPUT:
+
+    - ``graph`` -- a Sage graph, the pattern `H`
+
+    OUTPUT:
+
+    - a list of pairs of a canonically labelled Sage graph and a nonzero
+      ``Fraction``, one pair per isomorphism class of quotients
+
+    EXAMPLES::
+
+        sage: from helpers.subgraph_basis import subgraph_basis
+        sage: [(quotient.order(), coefficient) for quotient, coefficient in subgraph_basis(graphs.PathGraph(3))]
+        [(2, Fraction(-1, 2)), (3, Fraction(1, 2))]
+    """
+    vertices = graph.vertices()
+    automorphisms = graph.automorphism_group().cardinality()
+
+    basis = {}
+    for partition in set_partitions(vertices):
+        block_of = {vertex: index for index, block in enumerate(partition) for vertex in block}
+        if any(block_of[u] == block_of[v] for u, v in graph.edges(labels=False)):
+            continue
+
+        quotient = Graph()
+        quotient.add_vertices(range(len(partition)))
+        quotient.add_edges({tuple(sorted((block_of[u], block_of[v]))) for u, v in graph.edges(labels=False)})
+        quotient = quotient.canonical_label()
+
+        sign = 1
+        for block in partition:
+            sign *= (-1) ** (len(block) - 1) * factorial(len(block) - 1)
+
+        key = quotient.graph6_string()
+        if key not in basis:
+            basis[key] = [quotient, Fraction(0)]
+        basis[key][1] += Fraction(sign, automorphisms)
+
+    # Coefficients of isomorphic quotients may cancel out
+    return [(quotient, coefficient) for quotient, coefficient in basis.values() if coefficient]
+
+def set_partitions(items):
+    r"""
+    Yield every partition of the list ``items``, as a list of blocks (lists).
+
+    EXAMPLES::
+
+        sage: from helpers.subgraph_basis import set_partitions
+        sage: list(set_partitions([0, 1, 2]))
+        [[[0, 1, 2]], [[0], [1, 2]], [[0, 1], [2]], [[1], [0, 2]], [[0], [1], [2]]]
+    """
+    if not items:
+        yield []
+        return
+
+    first, rest = items[0], items[1:]
+    for partition in set_partitions(rest):
+        # `first` joins one of the blocks, or gets its own
+        for index, block in enumerate(partition):
+            yield partition[:index] + [[first] + block] + partition[index + 1:]
+        yield [[first]] + partition
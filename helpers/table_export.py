@@ -0,0 +1,259 @@
+r"""
+Export of selected DP tables, for debugging and downstream analysis.
+
+A :class:`TableExport` saves the tables of the nodes it selects into a
+directory, while a count runs: both engines take it as their ``export``
+argument. Every table ``node-<index>`` is written as
+
+- ``node-<index>.npy``, a flat NPY array, or ``node-<index>.arrow``, an Arrow
+  IPC file with a single ``count`` column, the JSON metadata below being
+  also stored in its schema metadata (key ``hom_table``);
+- ``node-<index>.json``, its metadata: the key of the count (the hash of the
+  pattern, target and decomposition, see ``counter_manifest`` in
+  `helpers/checkpoint.py`), the node type, the bag, ``target_size`` and the
+  dtype.
+
+The entry of a flat table at index `\sum_i x_i n^i` counts the partial
+homomorphisms sending ``bag[i]`` to `x_i` (vertices are written with
+``repr``); reshaped to ``(n,) * len(bag)`` the digit of ``bag[i]`` is on axis
+``axes[i]``. int64 tables are written straight from their buffer; tables of
+exact Python integers are written as decimal strings, so nothing is pickled.
+
+Writes overlap with the computation: the standard engine writes on a
+background thread and waits for its writes before returning; the parallel
+engine writes every table in a Dask task of its own, which no computing task
+depends on, and its result waits for all of them, so that writes made by
+other processes or machines are complete, and their errors raised. A table
+file exists only once the table is complete; the metadata file is written
+last. Tables must not be modified once computed, which the engines never do.
+
+An export directory can then be read back: :meth:`TableExport.load` returns a
+table as the engines hold it, and a count given ``resume_from=TableExport(path)``
+loads the topmost exported tables instead of computing their subtrees, so a
+computation restarts from any exported node, with either engine.
+"""
+import glob
+import hashlib
+import json
+import os
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+
+from helpers.array_kernels import digit_axis
+from helpers.checkpoint import _atomic_write, counter_manifest
+
+
+EXPORT_FORMATS = ('npy', 'arrow')
+
+# Key of the metadata in the schema of Arrow files
+ARROW_METADATA_KEY = b'hom_table'
+
+
+class TableExport:
+    r"""
+    The exported tables of the nodes ``nodes`` of a count, in ``directory``.
+
+    INPUT:
+
+    - ``directory`` -- the export directory, created if needed
+
+    - ``nodes`` (default: None) -- the indices of the nodes whose tables are
+      exported, by default every node
+
+    - ``format`` (default: ``'npy'``) -- ``'npy'`` or ``'arrow'``
+
+    EXAMPLES::
+
+        sage: from helpers.table_export import TableExport
+        sage: counter = GraphHomomorphismCounter(graphs.CycleGraph(4), graphs.PetersenGraph())
+        sage: export = TableExport("tables", format='arrow')  # not tested
+        sage: counter.count_homomorphisms(export=export)  # not tested
+        150
+        sage: export.top_partial_maps("node-1", limit=1)  # not tested
+        [({'0': 0}, 15)]
+        sage: GraphHomomorphismCounter(graphs.CycleGraph(4), graphs.PetersenGraph()).count_homomorphisms(resume_from=export)  # not tested
+        150
+
+    Both engines resume from a table below the root exported as Arrow, whose
+    loaded copy must be writeable for the Numba kernels::
+
+        sage: import tempfile
+        sage: from helpers.autotune import MachineProfile
+        sage: from parallel_hom_count import ParallelGraphHomomorphismCounter
+        sage: pattern, target = graphs.StarGraph(3), graphs.PetersenGraph()
+        sage: directory = tempfile.mkdtemp()
+        sage: GraphHomomorphismCounter(pattern, target).count_homomorphisms(
+        ....:     export=TableExport(directory, nodes=[1], format='arrow'))
+        270
+        sage: TableExport(directory).load("node-1").flags.writeable
+        True
+        sage: numba = MachineProfile({'prepared': 0.5, 'sage': 0.5}, 1e9, 2**14, 1)
+        sage: GraphHomomorphismCounter(pattern, target, profile=numba).count_homomorphisms(  # needs numba
+        ....:     resume_from=TableExport(directory))
+        270
+        sage: ParallelGraphHomomorphismCounter(pattern, target).count_homomorphisms_parallel(
+        ....:     resume_from=TableExport(directory)).compute()
+        array([270])
+    """
+    def __init__(self, directory, nodes=None, format='npy'):
+        if format not in EXPORT_FORMATS:
+            raise ValueError(f"format must be one of {EXPORT_FORMATS}")
+        self.directory = directory
+        self.nodes = None if nodes is None else set(nodes)
+        self.format = format
+        self.key = None
+        self.bags = {}
+        self._writer = None
+        self._pending = []
+
+    def __getstate__(self):
+        # Worker processes start their own writer thread
+        return {key: value for key, value in self.__dict__.items() if key not in ('_writer', '_pending')}
+
+    def __setstate__(self, state):
+        self.__dict__.update(state, _writer=None, _pending=[])
+
+    def bind(self, counter):
+        r"""
+        Attach this export to the count of ``counter``, raising ``ValueError`` if ``directory`` holds the tables of another count.
+        """
+        key = hashlib.sha256(json.dumps(counter_manifest(counter), sort_keys=True).encode()).hexdigest()
+        os.makedirs(self.directory, exist_ok=True)
+        for path in glob.glob(os.path.join(self.directory, "node-*.json")):
+            with open(path) as f:
+                if json.load(f)['key'] != key:
+                    raise ValueError(f"{self.directory} holds the tables of another count")
+
+        self.key = key
+        self.target_size = counter.actual_target_size
+        self.bags = {node[0]: (counter.dir_labelled_TD.get_vertex(node), [repr(vertex) for vertex in tuple(node[1])])
+                     for node in counter.dir_labelled_TD}
+        return self
+
+    def wants(self, node_index):
+        r"""
+        Return whether the table of the node ``node_index`` is exported.
+        """
+        return self.nodes is None or node_index in self.nodes
+
+    def has(self, name):
+        r"""
+        Return whether the table ``name`` has been exported.
+        """
+        return os.path.exists(self._path(name, 'json'))
+
+    def metadata(self, name):
+        r"""
+        Return the metadata of the exported table ``name``, a dictionary.
+        """
+        with open(self._path(name, 'json')) as f:
+            return json.load(f)
+
+    def load(self, name, dtype=None):
+        r"""
+        Return the exported table ``name``, as an int64 or object numpy array, or as ``dtype`` if given.
+        """
+        metadata = self.metadata(name)
+        if metadata['format'] == 'arrow':
+            import pyarrow as pa
+
+            with pa.memory_map(self._path(name, 'arrow')) as source:
+                column = pa.ipc.open_file(source).read_all().column('count').combine_chunks()
+            # A zero-copy view of the Arrow buffer is read-only, which the Numba kernels reject
+            table = column.to_numpy().copy() if metadata['dtype'] == 'int64' else column.to_pylist()
+        else:
+            table = np.load(self._path(name, 'npy'))
+
+        if metadata['dtype'] != 'int64':
+            table = np.array([int(count) for count in table], dtype=object)
+        return table if dtype is None else table.astype(dtype, copy=False)
+
+    def top_partial_maps(self, name, limit=10):
+        r"""
+        Return the ``limit`` partial maps of the bag of ``name`` with the largest counts, as pairs ``(map, count)``.
+
+        A map is a dictionary from the vertices of the bag, as written by
+        ``repr``, to their images.
+        """
+        metadata = self.metadata(name)
+        table = self.load(name)
+        if table.dtype == np.int64 and limit < len(table):
+            indices = np.argpartition(table, len(table) - limit)[len(table) - limit:]
+        else:
+            indices = range(len(table))
+        indices = sorted(indices, key=lambda index: table[index], reverse=True)[:limit]
+
+        n = metadata['target_size']
+        return [({vertex: int(index) // n**position % n for position, vertex in enumerate(metadata['bag'])},
+                 int(table[index])) for index in indices]
+
+    def save(self, name, table):
+        r"""
+        Export ``table`` as ``name`` in the background, and return it.
+
+        ``table`` (a numpy array or a list of integers) must not be modified afterwards.
+        """
+        if self._writer is None:
+            self._writer = ThreadPoolExecutor(max_workers=1)
+        self._pending.append(self._writer.submit(self._write, name, table))
+        return table
+
+    def write(self, name, table):
+        r"""
+        Export ``table`` as ``name`` in the calling thread.
+
+        The write tasks of the parallel engine, which may run in another
+        process, use this rather than :meth:`save`, whose background writes
+        only a :meth:`flush` in the same process waits for.
+        """
+        self._write(name, table)
+
+    def flush(self):
+        r"""
+        Wait for every background write of this process, raising the first error.
+        """
+        pending, self._pending = self._pending, []
+        for future in pending:
+            future.result()
+
+    def _write(self, name, table):
+        if not isinstance(table, np.ndarray):
+            table = np.array(table, dtype=np.int64 if all(-2**63 <= x < 2**63 for x in table) else object)
+        int64 = table.dtype == np.int64
+
+        node_type, bag = self.bags[int(name.split('-')[1])]
+        metadata = {
+            'key': self.key,
+            'node': name,
+            'type': node_type,
+            'bag': bag,
+            'axes': [digit_axis(len(bag), position) for position in range(len(bag))],
+            'target_size': self.target_size,
+            'dtype': 'int64' if int64 else 'int',
+            'length': len(table),
+            'format': self.format,
+        }
+
+        if self.format == 'arrow':
+            import pyarrow as pa
+
+            if int64:
+                # A view of the table's buffer
+                column = pa.Array.from_buffers(pa.int64(), len(table), [None, pa.py_buffer(np.ascontiguousarray(table))])
+            else:
+                column = pa.array([str(count) for count in table], type=pa.string())
+            schema = pa.schema([('count', column.type)], metadata={ARROW_METADATA_KEY: json.dumps(metadata)})
+
+            def write(f):
+                with pa.ipc.new_file(f, schema) as writer:
+                    writer.write(pa.record_batch([column], schema=schema))
+            _atomic_write(self._path(name, 'arrow'), write)
+        else:
+            _atomic_write(self._path(name, 'npy'), lambda f: np.save(f, table if int64 else table.astype(str)))
+
+        _atomic_write(self._path(name, 'json'), lambda f: f.write(json.dumps(metadata, indent=1).encode()))
+
+    def _path(self, name, suffix):
+        return os.path.join(self.directory, f"{name}.{suffix}")
+
@@ -0,0 +1,255 @@
+r"""
+Compact, picklable task payloads for the parallel engine.
+
+A fused task (see ``ParallelGraphHomomorphismCounter.build_task_graph``) is
+sent to a worker as a :class:`TaskSpec`: a short program for a stack machine,
+whose instructions only hold an opcode and a few bag positions, together with
+a :class:`SharedTarget` handle. Neither the Sage pattern, nor the target graph,
+nor the decomposition is pickled into tasks.
+
+The program lists the nodes of the task children first (post-order), so that
+evaluating it with a stack computes every table right after its children:
+
+- ``('leaf',)`` pushes the table of a leaf;
+- ``('input', i)`` pushes the ``i``-th table computed by another task;
+- ``('intro', bag_size, intro_index, nbr_positions, colour, pinned)`` replaces the top table;
+- ``('forget', bag_size, forgotten_index)`` replaces the top table;
+- ``('join',)`` replaces the two top tables by their product.
+
+``bag_size`` is the size of the *child* bag, ``colour`` is the colour of the
+intro vertex when counting colourful homomorphisms, ``None`` otherwise, and
+``pinned`` tells whether the images of the intro vertex are restricted to the
+``domain`` of the spec (see ``count_homomorphisms_sharded``).
+"""
+import os
+import tempfile
+import threading
+import uuid
+import weakref
+from collections import Counter, OrderedDict, namedtuple
+
+import numpy as np
+
+from helpers.array_kernels import intro_array, forget_array, join_array
+from helpers.dp_kernels import allowed_images
+from helpers.numba_kernels import intro_table, forget_table, join_table
+
+
+# `dtype` is 'int64' when every count fits in 64 bits (Numba kernels), and
+# 'object' otherwise (exact Python integers, through array broadcasting).
+# `domain`, if any, is a uint8 mask of the images allowed for pinned vertices.
+TaskSpec = namedtuple('TaskSpec', ['program', 'target', 'dtype', 'domain'], defaults=(None,))
+
+# Targets loaded in this process, the least recently used first:
+# key -> (adjacency, colours, allowed images by colour)
+_LOADED_TARGETS = OrderedDict()
+
+# Live handles of every loaded target in this process; a target without one
+# is idle, and only the `MAX_IDLE_TARGETS` most recently used idle targets are kept
+_HANDLE_COUNTS = Counter()
+MAX_IDLE_TARGETS = 2
+# Reentrant, as finalizers may run during a garbage collection in a locked section
+_TARGETS_LOCK = threading.RLock()
+
+
+class SharedTarget:
+    r"""
+    A handle to a target graph prepared for the kernels, loaded once per process.
+
+    The handle travels with every task. It is pickled in one of two ways:
+
+    - by default, as a key and a file path: the first pickle writes the dense
+      adjacency matrix (and the colours) to a file in ``directory``, the
+      local temporary directory if None, and every worker process loads it
+      once, on the first task that needs it. Workers on other hosts can only
+      read it if ``directory`` is on a filesystem they share;
+    - as a key and a ``dask.distributed`` future: the first pickle scatters
+      the adjacency matrix, packed to one bit per entry, to every worker of
+      the client (``broadcast=True``), and every worker process unpacks it
+      once, on the first task that needs it. Handles are pickled this way when
+      no ``directory`` is given and a ``dask.distributed`` client is active,
+      as its workers may run on other hosts.
+
+    With a threaded scheduler nothing is pickled. A worker process keeps the
+    targets of its live handles, and the ``MAX_IDLE_TARGETS`` last used others.
+
+    INPUT:
+
+    - ``adjacency`` -- the adjacency matrix of the target, as a uint8 numpy array
+
+    - ``colours`` (default: None) -- the colours of the target vertices, if any
+
+    - ``directory`` (default: None) -- where the target file is written
+    """
+    def __init__(self, adjacency, colours=None, directory=None):
+        self.key = uuid.uuid4().hex
+        self.path = None
+        self.directory = directory
+        self.size = len(adjacency)
+        self._scattered = None
+
+        colours = None if colours is None else np.asarray(colours)
+        with _TARGETS_LOCK:
+            _LOADED_TARGETS[self.key] = (adjacency, colours, {})
+        self._finalizer = _register_handle(self, self.key, None, owner=True)
+
+    def __getstate__(self):
+        state = {'key': self.key, 'path': self.path, 'directory': self.directory, 'size': self.size,
+                 'scattered': self._scattered}
+        if self._scattered is None and self.directory is None:
+            client = _distributed_client()
+            if client is not None:
+                adjacency, colours, _ = self.load()
+                # A list, so that the packed matrix and the colours are scattered as one object
+                [self._scattered] = client.scatter([(np.packbits(adjacency, axis=None), colours)],
+                                                   broadcast=True, hash=False)
+                state['scattered'] = self._scattered
+        if self._scattered is not None:
+            return state
+
+        if self.path is None:
+            adjacency, colours, _ = self.load()
+            directory = self.directory or tempfile.gettempdir()
+            self.path = os.path.join(directory, f"hom-count-target-{self.key}.npz")
+            with open(self.path, 'wb') as f:
+                np.savez(f, adjacency=adjacency, colours=colours if colours is not None else np.empty(0))
+
+            self._finalizer.detach()
+            self._finalizer = _register_handle(self, self.key, self.path, owner=True, count=False)
+
+        state['path'] = self.path
+        return state
+
+    def __setstate__(self, state):
+        self.key = state['key']
+        self.path = state['path']
+        self.directory = state['directory']
+        self.size = state['size']
+        self._scattered = state['scattered']
+        self._finalizer = _register_handle(self, self.key, None)
+
+    def __dask_tokenize__(self):
+        return self.key
+
+    def load(self):
+        r"""
+        Return ``(adjacency, colours, allowed_cache)``, reading the file or unpacking the scattered matrix at most once per process.
+        """
+        with _TARGETS_LOCK:
+            entry = _LOADED_TARGETS.get(self.key)
+            if entry is not None:
+                _LOADED_TARGETS.move_to_end(self.key)
+                return entry
+
+        if self._scattered is not None:
+            # Broadcast to every worker, so this is a local lookup
+            packed, colours = self._scattered.result()
+            adjacency = np.unpackbits(packed, count=self.size ** 2).reshape(self.size, self.size)
+            entry = (np.ascontiguousarray(adjacency), colours, {})
+        else:
+            if self.path is None or not os.path.exists(self.path):
+                raise FileNotFoundError(f"the target file {self.path} is not visible from this process; "
+                                        "give the counter a target_dir shared by every worker")
+            with np.load(self.path) as data:
+                colours = data['colours'] if len(data['colours']) else None
+                entry = (np.ascontiguousarray(data['adjacency']), colours, {})
+
+        with _TARGETS_LOCK:
+            entry = _LOADED_TARGETS.setdefault(self.key, entry)
+            _evict_idle_targets()
+        return entry
+
+    def allowed(self, colour, domain=None):
+        r"""
+        Return which target vertices a pattern vertex of colour ``colour`` may map to.
+
+        If ``domain`` is given, only the vertices it allows are kept.
+        """
+        _, colours, allowed_cache = self.load()
+        if colour not in allowed_cache:
+            allowed_cache[colour] = allowed_images(self.size, None if colour is None else colours, colour)
+        if domain is None:
+            return allowed_cache[colour]
+        return allowed_cache[colour] & domain
+
+
+def _distributed_client():
+    try:
+        from distributed import default_client
+    except ImportError:
+        return None
+    try:
+        return default_client()
+    except ValueError:
+        return None
+
+def _register_handle(handle, key, path, owner=False, count=True):
+    if count:
+        with _TARGETS_LOCK:
+            _HANDLE_COUNTS[key] += 1
+    return weakref.finalize(handle, _release_target, key, path, owner)
+
+def _release_target(key, path, owner=False):
+    with _TARGETS_LOCK:
+        _HANDLE_COUNTS[key] -= 1
+        if _HANDLE_COUNTS[key] <= 0:
+            del _HANDLE_COUNTS[key]
+            if owner:
+                # The process that created the target drops it with its last handle
+                _LOADED_TARGETS.pop(key, None)
+        _evict_idle_targets()
+    if path is not None and os.path.exists(path):
+        os.remove(path)
+
+def _evict_idle_targets():
+    idle = [key for key in _LOADED_TARGETS if key not in _HANDLE_COUNTS]
+    for key in idle[:max(0, len(idle) - MAX_IDLE_TARGETS)]:
+        del _LOADED_TARGETS[key]
+
+
+def run_task_spec(spec, *children_results, on_node=None):
+    r"""
+    Evaluate the program of ``spec`` and return the DP table it computes.
+
+    ``children_results`` are the tables of the tasks this one depends on, in
+    the order of the ``'input'`` instructions. ``on_node``, if given, is called
+    with the table of every other instruction, once computed.
+    """
+    target = spec.target
+    adjacency = target.load()[0]
+    n = target.size
+    stack = []
+
+    for instruction in spec.program:
+        match instruction[0]:
+            case 'leaf':
+                stack.append(np.ones(1, dtype=spec.dtype))
+            case 'input':
+                stack.append(children_results[instruction[1]])
+            case 'intro':
+                _, bag_size, intro_index, nbr_positions, colour, pinned = instruction
+                child = stack.pop()
+                allowed = target.allowed(colour, spec.domain if pinned else None)
+                if spec.dtype == 'int64':
+                    stack.append(intro_table(child, n, intro_index, nbr_positions, adjacency, allowed))
+                else:
+                    stack.append(intro_array(child, n, bag_size, intro_index, nbr_positions, adjacency, allowed))
+            case 'forget':
+                _, bag_size, forgotten_index = instruction
+                child = stack.pop()
+                if spec.dtype == 'int64':
+                    stack.append(forget_table(child, n, forgotten_index))
+                else:
+                    stack.append(forget_array(child, n, bag_size, forgotten_index))
+            case 'join':
+                right, left = stack.pop(), stack.pop()
+                if spec.dtype == 'int64':
+                    stack.append(join_table(left, right))
+                else:
+                    stack.append(join_array(left, right))
+
+        if on_node is not None and instruction[0] != 'input':
+            on_node(stack[-1])
+
+    (table,) = stack
+    return table
@@ -0,0 +1,190 @@
+r"""
+Opt-in per-node tracing of a count.
+
+A :class:`Trace` given to a count as ``trace=`` records one event per node
+of the decomposition: its type, bag size, table length, fraction of nonzero
+entries, wall time, the bytes of its table, and the process and thread that
+computed it. :meth:`Trace.write_chrome_trace` writes the events in the Chrome
+trace event format, which ``chrome://tracing`` and https://ui.perfetto.dev
+open; :meth:`Trace.summary` groups them by node type.
+
+Without a trace, a count only tests ``trace is not None`` once per node. With
+one, computing the statistics of a table reads it once more, and tables of
+exact Python integers are walked in Python: traced counts are slower.
+
+The parallel engine records the nodes of every task as it runs, in the
+process running it: trace it with a threaded scheduler (Dask's default for
+delayed objects). A task run by another process, with the process scheduler
+or ``dask.distributed``, raises ``RuntimeError`` rather than recording into
+a copy of the trace that would never come back.
+"""
+import json
+import os
+import sys
+import threading
+import time
+
+import numpy as np
+
+
+class Trace:
+    r"""
+    The events of the traced counts, in the order their nodes completed.
+
+    EXAMPLES::
+
+        sage: from helpers.tracing import Trace
+        sage: trace = Trace()
+        sage: GraphHomomorphismCounter(graphs.CycleGraph(4), graphs.PetersenGraph()).count_homomorphisms(trace=trace)
+        150
+        sage: print(trace.format_summary())  # random
+        type       nodes     seconds       max s       entries  nonzero         MB
+        forget         4      0.0001      0.0000           111    1.000       0.00
+        intro          4      0.0003      0.0001          1110    0.270       0.01
+        leaf           1      0.0000      0.0000             1    1.000       0.00
+        sage: trace.write_chrome_trace("count.json")  # not tested
+    """
+    def __init__(self):
+        self.events = []
+        self.origin_ns = time.perf_counter_ns()
+        self.pid = os.getpid()
+
+    def record(self, node_index, node_type, bag_size, table, start_ns, end_ns, backend=None):
+        r"""
+        Record that the node ``node_index`` computed ``table`` from ``start_ns`` to ``end_ns`` (``time.perf_counter_ns``).
+
+        ``backend`` names the kernel that computed the node, if known, see `helpers/autotune.py`.
+        """
+        length, nonzero, num_bytes = table_stats(table)
+        thread = threading.current_thread()
+        # Appending to a list is atomic, so threads record without a lock
+        self.events.append({
+            'node': node_index,
+            'type': node_type,
+            'bag_size': bag_size,
+            'length': length,
+            'nonzero_fraction': nonzero / length if length else 0.0,
+            'seconds': (end_ns - start_ns) / 1e9,
+            'bytes': num_bytes,
+            'backend': backend,
+            'pid': os.getpid(),
+            'thread_id': thread.native_id,
+            'thread': thread.name,
+            'start_ns': start_ns,
+        })
+
+    def chrome_trace(self):
+        r"""
+        Return the events in the Chrome trace event format, as a dictionary.
+        """
+        trace_events = [{
+            'name': f"{event['type']} {event['node']}",
+            'cat': event['type'],
+            'ph': 'X',
+            'ts': (event['start_ns'] - self.origin_ns) / 1e3,
+            'dur': event['seconds'] * 1e6,
+            'pid': event['pid'],
+            'tid': event['thread_id'],
+            'args': {key: event[key] for key in ('node', 'bag_size', 'length', 'nonzero_fraction', 'bytes',
+                                                         'backend')},
+        } for event in self.events]
+
+        threads = {(event['pid'], event['thread_id']): event['thread'] for event in self.events}
+        trace_events.extend({'name': 'thread_name', 'ph': 'M', 'pid': pid, 'tid': tid, 'args': {'name': name}}
+                            for (pid, tid), name in threads.items())
+        return {'traceEvents': trace_events, 'displayTimeUnit': 'ms'}
+
+    def write_chrome_trace(self, path):
+        r"""
+        Write the events to ``path``, a JSON file in the Chrome trace event format.
+        """
+        with open(path, 'w') as f:
+            json.dump(self.chrome_trace(), f)
+
+    def summary(self):
+        r"""
+        Return a list of dictionaries, one per node type, sorted by type.
+
+        Each one holds the ``type``, the number of ``nodes``, their total and
+        maximum ``seconds``, their total table ``entries`` and ``bytes``, the
+        ``nonzero_fraction`` of their entries, and the number of nodes computed
+        by each kernel, ``backends``.
+        """
+        rows = {}
+        for event in self.events:
+            row = rows.setdefault(event['type'], {'type': event['type'], 'nodes': 0, 'seconds': 0.0,
+                                                  'max_seconds': 0.0, 'entries': 0, 'nonzero': 0.0, 'bytes': 0,
+                                                  'backends': {}})
+            row['nodes'] += 1
+            row['seconds'] += event['seconds']
+            row['max_seconds'] = max(row['max_seconds'], event['seconds'])
+            row['entries'] += event['length']
+            row['nonzero'] += event['nonzero_fraction'] * event['length']
+            row['bytes'] += event['bytes']
+            row['backends'][event['backend']] = row['backends'].get(event['backend'], 0) + 1
+
+        for row in rows.values():
+            row['nonzero_fraction'] = row.pop('nonzero') / row['entries'] if row['entries'] else 0.0
+        return [rows[node_type] for node_type in sorted(rows)]
+
+    def format_summary(self):
+        r"""
+        Return :meth:`summary` as a text table.
+        """
+        lines = [f"{'type':<8}{'nodes':>8}{'seconds':>12}{'max s':>12}{'entries':>14}{'nonzero':>9}{'MB':>11}"]
+        for row in self.summary():
+            lines.append(f"{row['type']:<8}{row['nodes']:>8}{row['seconds']:>12.4f}{row['max_seconds']:>12.4f}"
+                         f"{row['entries']:>14}{row['nonzero_fraction']:>9.3f}{row['bytes'] / 2**20:>11.2f}")
+        return "\n".join(lines)
+
+
+def table_stats(table):
+    r"""
+    Return ``(length, nonzero, bytes)`` of a DP table, a numpy array or a list of integers.
+
+    The bytes of exact Python integers include each integer object.
+    """
+    if isinstance(table, np.ndarray) and table.dtype != object:
+        return table.size, int(np.count_nonzero(table)), table.nbytes
+    return len(table), sum(1 for count in table if count), table_bytes(table)
+
+def table_bytes(table):
+    r"""
+    Return the bytes of a DP table, a numpy array or a list of integers, including each exact Python integer.
+    """
+    if isinstance(table, np.ndarray) and table.dtype != object:
+        return table.nbytes
+    container = table.nbytes if isinstance(table, np.ndarray) else sys.getsizeof(table)
+    return container + sum(sys.getsizeof(count) for count in table)
+
+def check_same_process(recorder, kind):
+    r"""
+    Raise ``RuntimeError`` if ``recorder``, with the ``pid`` of the process that made it, was sent to another process.
+    """
+    if os.getpid() != recorder.pid:
+        raise RuntimeError(f"a {kind} only records tasks run by the process that made it: "
+                           "compute the count with a threaded scheduler, Dask's default for delayed objects")
+
+def traced_task(trace, nodes, run_task, spec, *children_results, on_node=None):
+    r"""
+    Return ``run_task(spec, *children_results)``, recording the nodes of the task in ``trace``.
+
+    ``nodes`` lists ``(node_index, node_type, bag_size)`` for every instruction of
+    the program of ``spec`` but its ``'input'`` instructions, in order.
+    ``on_node``, if given, is called with every table as well, outside of the
+    recorded times.
+    """
+    check_same_process(trace, "trace")
+    nodes = iter(nodes)
+    backend = 'numba' if spec.dtype == 'int64' else 'array'
+    last_ns = time.perf_counter_ns()
+
+    def on_table(table):
+        nonlocal last_ns
+        end_ns = time.perf_counter_ns()
+        trace.record(*next(nodes), table, last_ns, end_ns, backend)
+        if on_node is not None:
+            on_node(table)
+        last_ns = time.perf_counter_ns()
+
+    return run_task(spec, *children_results, on_node=on_table)
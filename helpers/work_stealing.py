@@ -0,0 +1,289 @@
+r"""
+A work-stealing thread scheduler for the nodes of a nice tree decomposition.
+
+For mid-sized counts, building a Dask graph and dispatching its tasks costs
+more than the DP itself. :func:`run_work_stealing` instead runs the nodes
+directly on a few threads:
+
+- every worker has its own deque, runs its newest item first, and when its
+  deque is empty steals the oldest item of another worker;
+- a node is pushed, by the worker completing its last child, on that
+  worker's deque, so chains run depth-first while the child table is hot;
+- the leaves are dealt to the workers by priority: the predicted work left
+  on the path from the leaf to the root, i.e. the critical path;
+- a node predicted to touch more than ``split_threshold`` entries is split
+  into pieces along the leading axis of its table (see
+  `helpers/array_kernels.py`), which idle workers steal.
+
+The pieces are numpy ufuncs and reductions writing into slices of the output
+table, which release the GIL on int64 tables.
+"""
+import os
+import random
+import threading
+from collections import deque
+
+import numpy as np
+
+from helpers.array_kernels import digit_axis, _along_axes
+from helpers.async_count import check_cancelled
+
+
+# Nodes predicted to touch more table entries than this are split into pieces
+SPLIT_THRESHOLD = 1 << 16
+
+
+class WorkStealingScheduler:
+    r"""
+    Run callables on ``num_workers`` threads, each with its own deque.
+
+    An item is called with the index of the worker running it, so that the
+    items it creates can be pushed on that worker's deque with :meth:`push`.
+    The run ends when an item calls :meth:`finish`, or raises.
+    """
+    def __init__(self, num_workers=None):
+        self.num_workers = num_workers or os.cpu_count()
+        self.deques = [deque() for _ in range(self.num_workers)]
+        self.condition = threading.Condition()
+        self.done = False
+        self.result = None
+        self.error = None
+
+    def push(self, worker, items):
+        r"""
+        Push ``items`` on the deque of ``worker``; the last one runs first.
+        """
+        self.deques[worker].extend(items)
+        with self.condition:
+            self.condition.notify_all()
+
+    def finish(self, result=None):
+        r"""
+        End the run, returning ``result``.
+        """
+        with self.condition:
+            self.result = result
+            self.done = True
+            self.condition.notify_all()
+
+    def run(self, items):
+        r"""
+        Run until some item calls :meth:`finish`, and return its result.
+
+        ``items`` are the initial items, by increasing priority: they are dealt
+        in turn to the workers, so that each deque has its most urgent item on top.
+        """
+        for index, item in enumerate(items):
+            self.deques[index % self.num_workers].append(item)
+
+        workers = [threading.Thread(target=self._work, args=(worker,), daemon=True)
+                   for worker in range(1, self.num_workers)]
+        for thread in workers:
+            thread.start()
+        self._work(0)
+        for thread in workers:
+            thread.join()
+
+        # Items left after an error hold references to tables
+        for items in self.deques:
+            items.clear()
+
+        if self.error is not None:
+            raise self.error
+        return self.result
+
+    def _work(self, worker):
+        own = self.deques[worker]
+        while not self.done:
+            try:
+                item = own.pop()
+            except IndexError:
+                item = self._steal(worker)
+
+            if item is None:
+                # A push notifies, the timeout covers a push racing this check
+                with self.condition:
+                    if not self.done:
+                        self.condition.wait(0.001)
+                continue
+
+            try:
+                item(worker)
+            except BaseException as error:
+                if self.error is None:
+                    self.error = error
+                self.finish()
+
+    def _steal(self, worker):
+        start = random.randrange(self.num_workers)
+        for offset in range(self.num_workers):
+            victim = (start + offset) % self.num_workers
+            if victim == worker:
+                continue
+            try:
+                return self.deques[victim].popleft()
+            except IndexError:
+                pass
+        return None
+
+
+def run_work_stealing(root, children, instructions, priority, target, dtype, domain=None, num_workers=None,
+                      split_threshold=SPLIT_THRESHOLD, cancel=None, on_node_done=None):
+    r"""
+    Return the flat DP table of ``root``, computed by a :class:`WorkStealingScheduler`.
+
+    INPUT:
+
+    - ``root`` -- the node whose table is computed
+
+    - ``children`` -- a dictionary from each node of the subtree of ``root`` to its children
+
+    - ``instructions`` -- a dictionary from each node to its instruction, see `helpers/task_specs.py`
+
+    - ``priority`` -- a dictionary from each node to its priority; only leaves are looked up
+
+    - ``target`` -- a :class:`~helpers.task_specs.SharedTarget`
+
+    - ``dtype`` -- 'int64', or 'object' for exact Python integers
+
+    - ``domain`` (default: None) -- the images allowed for pinned intro vertices, see `helpers/task_specs.py`
+
+    - ``num_workers`` (default: None) -- the number of threads, by default the number of cores
+
+    - ``split_threshold`` (default: ``SPLIT_THRESHOLD``) -- nodes predicted to touch
+      more table entries are split into pieces
+
+    - ``cancel`` (default: None) -- a `threading.Event`; once it is set, the
+      run stops before the next node or piece, raising
+      :class:`~helpers.async_count.CountCancelled`, and drops every table
+
+    - ``on_node_done`` (default: None) -- a function called with every node
+      whose table is complete, from the worker threads
+    """
+    scheduler = WorkStealingScheduler(num_workers)
+    parent = {child: node for node in children for child in children[node]}
+    waiting = {node: len(children[node]) for node in children}
+    tables = {}
+    lock = threading.Lock()
+
+    def complete(node, table, worker):
+        if on_node_done is not None:
+            on_node_done(node)
+        if node == root:
+            scheduler.finish(table)
+            return
+
+        with lock:
+            tables[node] = table
+            waiting[parent[node]] -= 1
+            ready = not waiting[parent[node]]
+        if ready:
+            scheduler.push(worker, [lambda worker, node=parent[node]: start(node, worker)])
+
+    def start(node, worker):
+        check_cancelled(cancel)
+        with lock:
+            children_tables = [tables.pop(child) for child in children[node]]
+
+        table, pieces = _node_pieces(instructions[node], children_tables, target, dtype, domain, split_threshold)
+        if len(pieces) <= 1:
+            for piece in pieces:
+                piece()
+            complete(node, table, worker)
+            return
+
+        # The worker finishing the last piece completes the node
+        remaining = [len(pieces)]
+        def run_piece(worker, piece):
+            check_cancelled(cancel)
+            piece()
+            with lock:
+                remaining[0] -= 1
+                last = not remaining[0]
+            if last:
+                complete(node, table, worker)
+
+        scheduler.push(worker, [lambda worker, piece=piece: run_piece(worker, piece) for piece in pieces])
+
+    leaves = sorted((node for node in children if not children[node]), key=lambda node: priority[node])
+    try:
+        return scheduler.run([lambda worker, node=node: start(node, worker) for node in leaves])
+    finally:
+        tables.clear()
+
+def _node_pieces(instruction, children_tables, target, dtype, domain, split_threshold):
+    r"""
+    Return the flat output table of a node, and the pieces filling it.
+
+    Each piece fills a range of the leading axis of the output table, of shape `(n,) * k`.
+    """
+    n = target.size
+
+    match instruction[0]:
+        case 'leaf':
+            return np.ones(1, dtype=dtype), []
+
+        case 'join':
+            left, right = children_tables
+            out = np.empty_like(left)
+            bounds = _split(len(out), _num_pieces(len(out), len(out), split_threshold))
+            return out, [lambda start=start, end=end: np.multiply(left[start:end], right[start:end], out=out[start:end])
+                         for start, end in bounds]
+
+        case 'forget':
+            _, child_bag_size, forgotten_index = instruction
+            (child,) = children_tables
+            child = child.reshape((n,) * child_bag_size)
+            forgotten_axis = digit_axis(child_bag_size, forgotten_index)
+
+            out = np.empty((n,) * (child_bag_size - 1), dtype=child.dtype)
+            if not out.ndim:
+                return out.reshape(-1), [lambda: np.sum(child, out=out)]
+
+            # The leading output axis is the leading child axis, unless that one is forgotten
+            def piece(start, end):
+                if forgotten_axis:
+                    np.sum(child[start:end], axis=forgotten_axis, out=out[start:end])
+                else:
+                    np.sum(child[:, start:end], axis=0, out=out[start:end])
+
+            bounds = _split(n, _num_pieces(child.size, n, split_threshold))
+            return out.reshape(-1), [lambda start=start, end=end: piece(start, end) for start, end in bounds]
+
+        case 'intro':
+            _, child_bag_size, intro_index, nbr_positions, colour, pinned = instruction
+            (child,) = children_tables
+            adjacency = target.load()[0]
+            bag_size = child_bag_size + 1
+            intro_axis = digit_axis(bag_size, intro_index)
+
+            child = child.reshape((n,) * child_bag_size)
+            child = child.reshape(child.shape[:intro_axis] + (1,) + child.shape[intro_axis:])
+            operands = [_along_axes(target.allowed(colour, domain if pinned else None), bag_size, (intro_axis,))]
+            for position in nbr_positions:
+                nbr_axis = digit_axis(bag_size, position if position < intro_index else position + 1)
+                operands.append(_along_axes(adjacency, bag_size, tuple(sorted((intro_axis, nbr_axis)))))
+
+            out = np.empty((n,) * bag_size, dtype=child.dtype)
+
+            # Broadcast operands have a leading axis of length 1, not sliced
+            def piece(start, end):
+                block = out[start:end]
+                np.multiply(_leading(child, start, end), _leading(operands[0], start, end), out=block)
+                for operand in operands[1:]:
+                    np.multiply(block, _leading(operand, start, end), out=block)
+
+            bounds = _split(n, _num_pieces(out.size, n, split_threshold))
+            return out.reshape(-1), [lambda start=start, end=end: piece(start, end) for start, end in bounds]
+
+        case _:
+            raise ValueError(f"unknown instruction {instruction!r}")
+
+def _num_pieces(work, max_pieces, split_threshold):
+    return max(1, min(max_pieces, -(-work // split_threshold)))
+
+def _split(length, num_pieces):
+    return [(piece * length // num_pieces, (piece + 1) * length // num_pieces) for piece in range(num_pieces)]
+
+def _leading(array, start, end):
+    return array[start:end] if array.shape[0] > 1 else array
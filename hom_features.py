@@ -0,0 +1,196 @@
+r"""
+Homomorphism count features of a whole dataset, in resumable shards.
+
+The dataset (graph6/sparse6, binary CSR or edge list files, see
+`helpers/graph_io.py`) is split into ``--shards`` byte ranges of nearly equal
+size, counted by ``--workers`` processes. Each worker computes the plans of
+the patterns once, when it starts, and then counts whole shards::
+
+    sage -python hom_features.py --patterns patterns.g6 --dataset data/*.g6 --output features --shards 256 --workers 8
+
+The output directory holds one Parquet file per shard, ``shard-<i>.parquet``,
+with a ``graph`` column (``"<file name>:<byte offset>"``, see
+`helpers/graph_io.py`) and one column per pattern, ``pattern_<j>``; and a
+``_manifest.json`` describing the patterns, the dataset and the shards, and
+recording every completed shard with its throughput. Shard files are written
+to a temporary name and renamed when complete, and the manifest is rewritten
+(atomically) after each one: a restarted run with the same arguments only
+counts the shards that are not recorded as complete.
+"""
+import argparse
+import json
+import multiprocessing
+import os
+import sys
+import tempfile
+import time
+from concurrent.futures import ProcessPoolExecutor, as_completed
+
+from helpers.graph_io import iter_graph_files, iter_graph_ranges, split_graph_files
+from hom_grid import count_cells, init_worker
+
+
+MODES = ('hom', 'rooted', 'subgraph')
+
+# Readers of Parquet datasets skip files starting with an underscore
+MANIFEST = '_manifest.json'
+
+
+def _shard_path(output_dir, shard):
+    return os.path.join(output_dir, f"shard-{shard:05d}.parquet")
+
+def _count_shard(shard, ranges, num_patterns, mode, output_dir):
+    r"""
+    Count the patterns of this worker in the graphs of ``ranges``, and write the Parquet file of ``shard``.
+
+    Return the throughput statistics of the shard.
+    """
+    import pyarrow as pa
+    import pyarrow.parquet as pq
+
+    start = time.perf_counter()
+    names = []
+    columns = [[] for _ in range(num_patterns)]
+    for target in iter_graph_ranges(ranges):
+        names.append(target.name)
+        for column, count in zip(columns, count_cells([(pattern_index, target, None)
+                                                       for pattern_index in range(num_patterns)])):
+            column.append(count)
+    seconds = time.perf_counter() - start
+
+    count_type = pa.list_(pa.int64()) if mode == 'rooted' else pa.int64()
+    schema = pa.schema([('graph', pa.string())] + [(f"pattern_{j}", count_type) for j in range(num_patterns)])
+    try:
+        table = pa.table([names] + columns, schema=schema)
+    except (OverflowError, pa.ArrowInvalid) as error:
+        raise OverflowError(f"counts of shard {shard} exceed 64 bits ({error})") from None
+
+    fd, temporary_path = tempfile.mkstemp(dir=output_dir, prefix='.tmp-')
+    os.close(fd)
+    pq.write_table(table, temporary_path)
+    os.replace(temporary_path, _shard_path(output_dir, shard))
+
+    graphs = len(names)
+    return {
+        'graphs': graphs,
+        'seconds': seconds,
+        'graphs_per_second': graphs / seconds if seconds else None,
+        'pattern_graphs_per_second': graphs * num_patterns / seconds if seconds else None,
+    }
+
+def _write_manifest(output_dir, manifest):
+    fd, temporary_path = tempfile.mkstemp(dir=output_dir, prefix='.tmp-')
+    with os.fdopen(fd, 'w') as f:
+        json.dump(manifest, f, indent=1, sort_keys=True)
+        f.flush()
+        os.fsync(f.fileno())
+    os.replace(temporary_path, os.path.join(output_dir, MANIFEST))
+
+def count_features(pattern_paths, dataset_paths, output_dir, num_shards, workers=None, mode='hom', root_vertex=0,
+                   log=None, cache_path=None):
+    r"""
+    Count the patterns of ``pattern_paths`` in every graph of ``dataset_paths``, into ``output_dir``.
+
+    INPUT:
+
+    - ``pattern_paths``, ``dataset_paths`` -- lists of graph files
+
+    - ``output_dir`` -- the output directory, created if needed
+
+    - ``num_shards`` -- the number of shards of the dataset
+
+    - ``workers`` (default: None) -- the number of worker processes, by default one per core
+
+    - ``mode`` (default: ``'hom'``) -- ``'hom'``, ``'rooted'`` or ``'subgraph'``, see `hom_grid.py`
+
+    - ``root_vertex`` (default: 0) -- the root vertex of the patterns, in rooted mode
+
+    - ``log`` (default: None) -- a function called with a line of text after every shard
+
+    - ``cache_path`` (default: None) -- a SQLite result cache, consulted and
+      filled (not in rooted mode), see `helpers/result_cache.py`
+
+    OUTPUT:
+
+    - the manifest, a dictionary, whose ``'completed'`` entry maps every shard to its statistics
+    """
+    if mode not in MODES:
+        raise ValueError(f"mode must be one of {MODES}")
+    if mode == 'rooted' and cache_path is not None:
+        raise ValueError("rooted counts are not cached")
+
+    patterns = list(iter_graph_files(pattern_paths))
+    shards = split_graph_files(dataset_paths, num_shards)
+    description = {
+        'patterns': [[pattern.num_vertices, pattern.indptr.tolist(), pattern.indices.tolist()] for pattern in patterns],
+        'mode': mode,
+        'root_vertex': root_vertex if mode == 'rooted' else None,
+        'dataset': [[os.path.abspath(path), os.path.getsize(path)] for path in dataset_paths],
+        'shards': shards,
+    }
+
+    os.makedirs(output_dir, exist_ok=True)
+    manifest = dict(description, completed={})
+    manifest_path = os.path.join(output_dir, MANIFEST)
+    if os.path.exists(manifest_path):
+        with open(manifest_path) as f:
+            previous = json.load(f)
+        if {key: previous.get(key) for key in description} != json.loads(json.dumps(description)):
+            raise ValueError(f"{output_dir} holds the features of other patterns, dataset or shards")
+        manifest['completed'] = {shard: stats for shard, stats in previous['completed'].items()
+                                 if os.path.exists(_shard_path(output_dir, int(shard)))}
+
+    todo = [shard for shard in range(num_shards) if str(shard) not in manifest['completed']]
+    log = log or (lambda line: None)
+
+    def record(shard, stats):
+        manifest['completed'][str(shard)] = stats
+        _write_manifest(output_dir, manifest)
+        # None when the shard took no measurable time; an empty shard has a rate of 0
+        rate = stats['graphs_per_second']
+        if rate is None:
+            rate = float('inf')
+        log(f"shard {shard}: {stats['graphs']} graphs in {stats['seconds']:.2f} s, "
+            f"{rate:.1f} graphs/s, {rate * len(patterns):.1f} pattern-graphs/s")
+
+    initargs = (patterns, mode, root_vertex, None, True, cache_path)
+    workers = min(workers or os.cpu_count(), max(1, len(todo)))
+    if workers == 1:
+        init_worker(*initargs)
+        for shard in todo:
+            record(shard, _count_shard(shard, shards[shard], len(patterns), mode, output_dir))
+    else:
+        with ProcessPoolExecutor(workers, mp_context=multiprocessing.get_context('spawn'),
+                                 initializer=init_worker, initargs=initargs) as executor:
+            futures = {executor.submit(_count_shard, shard, shards[shard], len(patterns), mode, output_dir): shard
+                       for shard in todo}
+            for future in as_completed(futures):
+                record(futures[future], future.result())
+
+    _write_manifest(output_dir, manifest)
+    return manifest
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0].strip())
+    parser.add_argument('--patterns', nargs='+', required=True, help="files of pattern graphs")
+    parser.add_argument('--dataset', nargs='+', required=True, help="files of the dataset")
+    parser.add_argument('--output', required=True, help="the output directory")
+    parser.add_argument('--shards', type=int, required=True, help="number of shards of the dataset")
+    parser.add_argument('--workers', type=int, default=None, help="number of worker processes (default: one per core)")
+    parser.add_argument('--mode', choices=MODES, default='hom')
+    parser.add_argument('--root', type=int, default=0, help="the root vertex of the patterns, in rooted mode")
+    parser.add_argument('--cache', help="a SQLite result cache, consulted and filled (not in rooted mode)")
+    args = parser.parse_args(argv)
+
+    start = time.perf_counter()
+    manifest = count_features(args.patterns, args.dataset, args.output, args.shards, args.workers, args.mode,
+                              args.root, log=lambda line: print(line, file=sys.stderr), cache_path=args.cache)
+    elapsed = time.perf_counter() - start
+    graphs = sum(stats['graphs'] for stats in manifest['completed'].values())
+    print(f"{len(manifest['completed'])}/{args.shards} shards complete, {graphs} graphs, in {elapsed:.2f} s",
+          file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,421 @@
+r"""
+Count every pattern against every target, from the command line.
+
+Patterns and targets are read from graph6/sparse6, binary CSR or edge list
+files (see `helpers/graph_io.py`), and numbered in file order from 0. The
+grid is computed by ``--workers`` processes, each counting all the patterns
+left for a chunk of targets, so that every prepared target and every plan
+(see `helpers/plan.py`) is reused across the grid::
+
+    sage -python hom_grid.py --patterns patterns.g6 --targets molecules.g6 --output counts.csv --workers 8
+
+The modes are:
+
+- ``hom``: the number of homomorphisms;
+- ``rooted``: the number of homomorphisms sending the pattern vertex
+  ``--root`` to each target vertex, as a list;
+- ``colourful``: the number of colour-preserving homomorphisms, the colours of
+  the targets being read from ``--target-colours`` (one line of integers per
+  target), and those of the patterns from ``--pattern-colours`` (by default,
+  every pattern vertex has its own colour);
+- ``subgraph``: the number of subgraphs of the target isomorphic to the
+  pattern, see `helpers/subgraph_basis.py`.
+
+Results are written as they finish, in completion order, to the format of
+the suffix of ``--output``:
+
+- ``.csv``: rows ``pattern,target,count`` (``counts``, space-separated, in rooted mode);
+- ``.npy``: a ``(patterns, targets)`` int64 matrix, -1 for cells not counted yet;
+- ``.parquet``: a directory of Parquet files with the columns of the CSV rows
+  (the counts of the rooted mode being a list column), one file per chunk.
+
+With ``--resume``, the cells already in the output are skipped, and the
+others are added to it; otherwise an existing output is an error. With
+``--cache``, the counts of every chunk are first looked up, in one batch, in
+a result cache shared by all runs (see `helpers/result_cache.py`), and the
+missing ones are counted and added to it.
+"""
+import argparse
+import csv
+import itertools
+import multiprocessing
+import os
+import sys
+import tempfile
+import time
+from concurrent.futures import FIRST_COMPLETED, ProcessPoolExecutor, wait
+
+import numpy as np
+
+from helpers.graph_io import iter_graph_files
+from helpers.plan import PatternPlan
+from helpers.prepared_target import ConvertedTarget
+from helpers.result_cache import ResultCache, canonical_hash
+from helpers.subgraph_basis import subgraph_basis
+from standard_hom_count import GraphHomomorphismCounter, count_subgraphs
+
+
+MODES = ('hom', 'rooted', 'colourful', 'subgraph')
+
+# Number of targets sent to a worker at once
+CHUNK_SIZE = 64
+
+
+### Workers
+
+# The patterns and the plans of a worker process, set by `init_worker`, and
+# the conversions of the target being counted, see `_converted_target`
+_WORKER = {}
+
+def init_worker(patterns, mode, root_vertex=0, pattern_colours=None, warm=False, cache_path=None):
+    r"""
+    Set the patterns (prepared targets) and the mode of this process; with ``warm``, compute their plans now.
+
+    With ``cache_path``, :func:`count_cells` goes through the result cache in
+    that SQLite database, see `helpers/result_cache.py`.
+    """
+    if cache_path is not None and mode == 'rooted':
+        raise ValueError("rooted counts are not cached")
+
+    _WORKER.update(patterns=[pattern.to_sage_graph() for pattern in patterns], mode=mode, root_vertex=root_vertex,
+                   pattern_colours=pattern_colours, plans={}, bases={}, quotient_plans={}, pattern_hashes={},
+                   converted=None,
+                   cache=ResultCache(cache_path) if cache_path is not None else None)
+
+    if warm:
+        for pattern_index, pattern in enumerate(_WORKER['patterns']):
+            if mode == 'subgraph':
+                _WORKER['bases'][pattern_index] = basis = subgraph_basis(pattern)
+                for quotient, _ in basis:
+                    _WORKER['quotient_plans'].setdefault(quotient.graph6_string(), PatternPlan(quotient))
+            else:
+                _pattern_plan(pattern_index)
+
+def _pattern_plan(pattern_index):
+    plans = _WORKER['plans']
+    if pattern_index not in plans:
+        root_vertex = _WORKER['root_vertex'] if _WORKER['mode'] == 'rooted' else None
+        plans[pattern_index] = PatternPlan(_WORKER['patterns'][pattern_index], root_vertex)
+    return plans[pattern_index]
+
+def _pattern_colours(pattern_index):
+    pattern_colours = _WORKER['pattern_colours']
+    if pattern_colours is None:
+        return list(range(len(_WORKER['patterns'][pattern_index])))
+    return pattern_colours[pattern_index]
+
+def _pattern_hash(pattern_index):
+    hashes = _WORKER['pattern_hashes']
+    if pattern_index not in hashes:
+        colours = _pattern_colours(pattern_index) if _WORKER['mode'] == 'colourful' else None
+        hashes[pattern_index] = canonical_hash(_WORKER['patterns'][pattern_index], colours)
+    return hashes[pattern_index]
+
+def _converted_target(target):
+    r"""
+    Return the :class:`~helpers.prepared_target.ConvertedTarget` of ``target``, kept while consecutive cells share it.
+    """
+    converted = _WORKER['converted']
+    if converted is None or converted.target_graph is not target:
+        converted = _WORKER['converted'] = ConvertedTarget(target)
+    return converted
+
+def count_cells(cells):
+    r"""
+    Return the counts of ``cells``, a list of ``(pattern_index, target, target_colours)``.
+
+    With a result cache, the counts of all the cells are looked up at once,
+    and the missing ones are counted and then stored at once.
+    """
+    cache = _WORKER['cache']
+    if cache is None:
+        return [count_cell(*cell) for cell in cells]
+
+    # Consecutive cells usually share their target
+    target_hashes = {}
+    keys = []
+    for pattern_index, target, target_colours in cells:
+        if id(target) not in target_hashes:
+            target_hashes[id(target)] = canonical_hash(target, target_colours if _WORKER['mode'] == 'colourful' else None)
+        keys.append((_pattern_hash(pattern_index), target_hashes[id(target)], _WORKER['mode']))
+
+    counts = cache.get_many(keys)
+    computed = {}
+    for key, cell in zip(keys, cells):
+        if key not in counts:
+            counts[key] = computed[key] = count_cell(*cell)
+    cache.put_many(computed.items())
+
+    return [counts[key] for key in keys]
+
+def count_cell(pattern_index, target, target_colours=None):
+    r"""
+    Return the count of the pattern ``pattern_index`` in ``target``, in the mode set by :func:`init_worker`.
+    """
+    pattern = _WORKER['patterns'][pattern_index]
+    converted = _converted_target(target)
+
+    match _WORKER['mode']:
+        case 'hom':
+            plan = _pattern_plan(pattern_index)
+            return GraphHomomorphismCounter(plan.graph, target, plan=plan, converted=converted).count_homomorphisms()
+        case 'rooted':
+            plan = _pattern_plan(pattern_index)
+            counter = GraphHomomorphismCounter(plan.graph, target, plan=plan, converted=converted)
+            return counter.count_rooted_homomorphisms()
+        case 'colourful':
+            plan = _pattern_plan(pattern_index)
+            counter = GraphHomomorphismCounter(plan.graph, target, graph_clr=_pattern_colours(pattern_index),
+                                               target_clr=target_colours, colourful=True, plan=plan,
+                                               converted=converted)
+            return counter.count_homomorphisms()
+        case 'subgraph':
+            bases = _WORKER['bases']
+            if pattern_index not in bases:
+                bases[pattern_index] = subgraph_basis(pattern)
+            return count_subgraphs(pattern, target, bases[pattern_index], _WORKER['quotient_plans'],
+                                   converted=converted)
+
+def _count_chunk(chunk):
+    r"""
+    Return the rows ``(pattern, target, count)`` of ``chunk``, a list of
+    ``(target_index, target, target_colours, pattern_indices)``.
+    """
+    cells = [(target_index, pattern_index, target, target_colours)
+             for target_index, target, target_colours, pattern_indices in chunk
+             for pattern_index in pattern_indices]
+    counts = count_cells([(pattern_index, target, target_colours) for _, pattern_index, target, target_colours in cells])
+    return [(pattern_index, target_index, count) for (target_index, pattern_index, _, _), count in zip(cells, counts)]
+
+
+### Outputs
+
+class CsvGridWriter:
+    r"""
+    Rows ``pattern,target,count`` appended to a CSV file, flushed after every chunk.
+    """
+    def __init__(self, path, mode, resume):
+        self.column = 'counts' if mode == 'rooted' else 'count'
+        self.done = set()
+
+        if resume and os.path.exists(path):
+            # Drop a row cut by a crash
+            with open(path, 'rb+') as f:
+                data = f.read()
+                f.truncate(data.rfind(b'\n') + 1)
+            with open(path, newline='') as f:
+                self.done = {(int(row['pattern']), int(row['target'])) for row in csv.DictReader(f)}
+
+        self.file = open(path, 'a', newline='')
+        self.writer = csv.writer(self.file)
+        if self.file.tell() == 0:
+            self.writer.writerow(['pattern', 'target', self.column])
+
+    def write(self, rows):
+        self.writer.writerows((pattern, target, ' '.join(map(str, count)) if isinstance(count, list) else count)
+                              for pattern, target, count in rows)
+        self.file.flush()
+
+    def close(self):
+        self.file.close()
+
+
+class NpyGridWriter:
+    r"""
+    A ``(patterns, targets)`` int64 matrix memory-mapped from a ``.npy`` file, -1 in the cells not counted yet.
+    """
+    def __init__(self, path, mode, resume, shape):
+        if mode == 'rooted':
+            raise ValueError("rooted counts need a CSV or Parquet output")
+
+        if resume and os.path.exists(path):
+            self.grid = np.lib.format.open_memmap(path, mode='r+')
+            if self.grid.shape != shape or self.grid.dtype != np.int64:
+                raise ValueError(f"{path} holds a {self.grid.dtype} matrix of shape {self.grid.shape}, "
+                                 f"not an int64 matrix of shape {shape}")
+            self.done = set(zip(*map(np.ndarray.tolist, np.nonzero(self.grid >= 0))))
+        else:
+            self.grid = np.lib.format.open_memmap(path, mode='w+', dtype=np.int64, shape=shape)
+            self.grid[:] = -1
+            self.done = set()
+
+    def write(self, rows):
+        for pattern, target, count in rows:
+            if count >= 2**63:
+                raise OverflowError(f"the count of pattern {pattern} in target {target} exceeds 64 bits, "
+                                    f"use a CSV output")
+            self.grid[pattern, target] = count
+        self.grid.flush()
+
+    def close(self):
+        self.grid.flush()
+        del self.grid
+
+
+class ParquetGridWriter:
+    r"""
+    A directory of Parquet files, one per chunk, each written to a temporary name and renamed when complete.
+    """
+    def __init__(self, path, mode, resume):
+        import pyarrow as pa
+        import pyarrow.parquet as pq
+
+        self.pa, self.pq = pa, pq
+        self.path = path
+        self.column = 'counts' if mode == 'rooted' else 'count'
+        self.schema = pa.schema([('pattern', pa.int64()), ('target', pa.int64()),
+                                 (self.column, pa.list_(pa.int64()) if mode == 'rooted' else pa.int64())])
+        self.done = set()
+
+        os.makedirs(path, exist_ok=True)
+        parts = sorted(name for name in os.listdir(path) if name.startswith('part-') and name.endswith('.parquet'))
+        if parts and not resume:
+            raise FileExistsError(f"{path} already holds results, pass --resume to add to them")
+        for part in parts:
+            table = pq.read_table(os.path.join(path, part), columns=['pattern', 'target'])
+            self.done.update(zip(table['pattern'].to_pylist(), table['target'].to_pylist()))
+        self.next_part = 1 + max((int(part[len('part-'):-len('.parquet')]) for part in parts), default=-1)
+
+    def write(self, rows):
+        if not rows:
+            return
+        patterns, targets, counts = zip(*rows)
+        try:
+            table = self.pa.table([patterns, targets, counts], schema=self.schema)
+        except (OverflowError, self.pa.ArrowInvalid) as error:
+            raise OverflowError(f"counts exceed 64 bits, use a CSV output ({error})") from None
+
+        fd, temporary_path = tempfile.mkstemp(dir=self.path, prefix='.tmp-')
+        os.close(fd)
+        self.pq.write_table(table, temporary_path)
+        os.replace(temporary_path, os.path.join(self.path, f"part-{self.next_part:06d}.parquet"))
+        self.next_part += 1
+
+    def close(self):
+        pass
+
+
+def open_grid_output(path, mode, resume, shape):
+    r"""
+    Return the writer of the output ``path``, by suffix; its ``done`` attribute holds the cells already written.
+    """
+    if path.endswith('.parquet'):
+        return ParquetGridWriter(path, mode, resume)
+    if os.path.exists(path) and not resume:
+        raise FileExistsError(f"{path} already exists, pass --resume to add to it")
+    if path.endswith('.csv'):
+        return CsvGridWriter(path, mode, resume)
+    if path.endswith('.npy'):
+        return NpyGridWriter(path, mode, resume, shape)
+    raise ValueError("the output must end with .csv, .npy or .parquet")
+
+
+### Grid
+
+def iter_colours(path):
+    r"""
+    Yield the colours of ``path``, a list of integers per line.
+    """
+    with open(path) as f:
+        for line in f:
+            yield [int(colour) for colour in line.split()]
+
+def _with_colours(targets, target_colours):
+    r"""
+    Yield the pairs ``(target, colours)``, raising ``ValueError`` if there are more targets than colour lines or fewer.
+    """
+    missing = object()
+    for target, colours in itertools.zip_longest(targets, target_colours, fillvalue=missing):
+        if target is missing or colours is missing:
+            raise ValueError("the target colours file must have one line per target")
+        yield target, colours
+
+def count_grid(pattern_paths, target_paths, output, mode='hom', workers=None, chunk_size=CHUNK_SIZE, root_vertex=0,
+               pattern_colours_path=None, target_colours_path=None, resume=False, cache_path=None):
+    r"""
+    Count every pattern of ``pattern_paths`` against every target of ``target_paths`` into ``output``.
+
+    See the description of this module for the arguments. Return the number of cells counted.
+    """
+    if mode not in MODES:
+        raise ValueError(f"mode must be one of {MODES}")
+    if mode == 'colourful' and target_colours_path is None:
+        raise ValueError("the colourful mode needs the colours of the targets")
+    if mode == 'rooted' and cache_path is not None:
+        raise ValueError("rooted counts are not cached")
+
+    patterns = list(iter_graph_files(pattern_paths))
+    pattern_colours = list(iter_colours(pattern_colours_path)) if pattern_colours_path is not None else None
+    num_targets = sum(1 for _ in iter_graph_files(target_paths)) if output.endswith('.npy') else None
+    writer = open_grid_output(output, mode, resume, (len(patterns), num_targets))
+
+    targets = iter_graph_files(target_paths)
+    if target_colours_path is not None:
+        targets = _with_colours(targets, iter_colours(target_colours_path))
+    else:
+        targets = zip(targets, itertools.repeat(None))
+    cells = ((target_index, target, colours,
+              [pattern_index for pattern_index in range(len(patterns)) if (pattern_index, target_index) not in writer.done])
+             for target_index, (target, colours) in enumerate(targets))
+    chunks = _chunks((cell for cell in cells if cell[3]), chunk_size)
+
+    initargs = (patterns, mode, root_vertex, pattern_colours, False, cache_path)
+    workers = workers or os.cpu_count()
+    counted = 0
+    try:
+        if workers == 1:
+            init_worker(*initargs)
+            for chunk in chunks:
+                rows = _count_chunk(chunk)
+                writer.write(rows)
+                counted += len(rows)
+            return counted
+
+        with ProcessPoolExecutor(workers, mp_context=multiprocessing.get_context('spawn'),
+                                 initializer=init_worker, initargs=initargs) as executor:
+            # A few chunks in flight per worker, so that huge datasets are streamed
+            pending = set()
+            for chunk in itertools.chain(chunks, [None]):
+                if chunk is not None:
+                    pending.add(executor.submit(_count_chunk, chunk))
+                while pending and (chunk is None or len(pending) >= 2 * workers):
+                    finished, pending = wait(pending, return_when=FIRST_COMPLETED)
+                    for future in finished:
+                        rows = future.result()
+                        writer.write(rows)
+                        counted += len(rows)
+        return counted
+    finally:
+        writer.close()
+
+def _chunks(iterable, size):
+    iterator = iter(iterable)
+    while chunk := list(itertools.islice(iterator, size)):
+        yield chunk
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0].strip())
+    parser.add_argument('--patterns', nargs='+', required=True, help="files of pattern graphs")
+    parser.add_argument('--targets', nargs='+', required=True, help="files of target graphs")
+    parser.add_argument('--output', required=True, help="a .csv, .npy or .parquet output")
+    parser.add_argument('--mode', choices=MODES, default='hom')
+    parser.add_argument('--workers', type=int, default=None, help="number of worker processes (default: one per core)")
+    parser.add_argument('--chunk-size', type=int, default=CHUNK_SIZE, help="number of targets per task")
+    parser.add_argument('--root', type=int, default=0, help="the root vertex of the patterns, in rooted mode")
+    parser.add_argument('--pattern-colours', help="colours of the patterns, one line per pattern")
+    parser.add_argument('--target-colours', help="colours of the targets, one line per target")
+    parser.add_argument('--resume', action='store_true', help="skip the cells already in the output")
+    parser.add_argument('--cache', help="a SQLite result cache, consulted and filled (not in rooted mode)")
+    args = parser.parse_args(argv)
+
+    start = time.perf_counter()
+    counted = count_grid(args.patterns, args.targets, args.output, args.mode, args.workers, args.chunk_size,
+                         args.root, args.pattern_colours, args.target_colours, args.resume, args.cache)
+    elapsed = time.perf_counter() - start
+    print(f"{counted} cells counted in {elapsed:.2f} s ({counted / max(elapsed, 1e-9):.1f} cells/s)",
+          file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
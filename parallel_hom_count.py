@@ -3,24 +3,47 @@ from dask import delayed
 from sage.graphs.graph import Graph
 
 from helpers.nice_tree_decomp import *
+from helpers.plan import PatternPlan
 from helpers.help_functions import *
+from helpers.prepared_target import PreparedTarget, dense_adjacency
+from helpers.numba_kernels import *
+from helpers.task_specs import SharedTarget, TaskSpec, run_task_spec
+from helpers.shared_tables import run_shared_task_spec, fetch_shared_table, run_in_process_pool
+from helpers.dask_tables import CHUNK_ENTRIES, dask_table
+from helpers.work_stealing import SPLIT_THRESHOLD, run_work_stealing
+from helpers.sharding import pinned_vertex_choice, image_weights, balanced_shards
+from helpers.checkpoint import counter_checkpoint, after_writes
+from helpers.async_count import run_in_worker
+from helpers.tracing import traced_task
+from helpers.memory_profile import profiled_task
+from helpers.explain import OPERATIONS_PER_SECOND, estimate_count
 
-from numba import jit
 import numpy as np
+import math
+import os
+import pickle
+import threading
+from functools import partial
 
 
+# Subtrees predicted to touch at most this many DP table entries are fused
+# into their parent's Dask task, as scheduling a task costs more
+FUSION_THRESHOLD = 1 << 16
+
 # In integer rep, the DP table is of the following form:
 # { node_index: [1, 2, 3, 4, 5],
 #   second_node_index: [10, 20, 30, 40, 50], ...}
 
 class ParallelGraphHomomorphismCounter:
-    def __init__(self, graph, target_graph, density_threshold=0.5, graph_clr=None, target_clr=None, colourful=False):
+    def __init__(self, graph, target_graph, density_threshold=0.5, graph_clr=None, target_clr=None, colourful=False,
+                 plan=None, target_dir=None):
         r"""
         INPUT:
 
         - ``graph`` -- a Sage graph
 
-        - ``target_graph`` -- the graph to which ``graph`` is sent
+        - ``target_graph`` -- the graph to which ``graph`` is sent, either a Sage graph
+          or a :class:`~helpers.prepared_target.PreparedTarget` (e.g. read by `helpers.graph_io`)
 
         - ``density_threshold`` (default: 0.5) -- the desnity threshold for `target_graph` representation
 
@@ -29,6 +52,14 @@ class ParallelGraphHomomorphismCounter:
         - ``target_clr`` (default: None) -- a list of integers representing the colours of the vertices of `target_graph`
 
         - ``colourful`` (default: False) -- whether the graph homomorphism is colour-preserving
+
+        - ``plan`` (default: None) -- the :class:`~helpers.plan.PatternPlan` of ``graph``,
+          to reuse its tree decomposition; computed if not given
+
+        - ``target_dir`` (default: None) -- a directory where the target is
+          written once for the worker processes; with workers on several hosts,
+          either a directory they all share, or None to scatter the target once
+          to every ``dask.distributed`` worker, see :class:`~helpers.task_specs.SharedTarget`
         """
         self.graph = graph
         self.target_graph = target_graph
@@ -43,213 +74,492 @@ class ParallelGraphHomomorphismCounter:
 
         if not isinstance(graph, Graph):
             raise ValueError("first argument must be a sage Graph")
-        if not isinstance(target_graph, Graph):
-            raise ValueError("second argument must be a sage Graph")
+        if not isinstance(target_graph, (Graph, PreparedTarget)):
+            raise ValueError("second argument must be a sage Graph or a PreparedTarget")
 
         if colourful and (graph_clr is None or target_clr is None):
             raise ValueError("Both graph_clr and target_clr must be provided when colourful is True")
 
         self.graph._scream_if_not_simple()
-        self.target_graph._scream_if_not_simple()
-
-        self.tree_decomp = graph.treewidth(certificate=True)
-        self.nice_tree_decomp = make_nice_tree_decomposition(graph, self.tree_decomp)
-        self.root = sorted(self.nice_tree_decomp)[0]
-
-        # Make it into directed graph for better access
-        # to children and parent, if needed
-        #
-        # Each node in a labelled nice tree decomposition
-        # has the following form:
-        #
-        # (node_index, bag_vertices) node_type
-        #
-        # Example: (5, {0, 4}) intro
-        self.dir_labelled_TD = label_nice_tree_decomposition(self.nice_tree_decomp, self.root, directed=True)
-
-        # `node_changes_dict` is responsible for recording introduced and
-        # forgotten vertices in a nice tree decomposition
-        self.node_changes_dict = node_changes(self.dir_labelled_TD)
-
-
-    def count_homomorphisms_parallel(self, node=None):
-        # We start from the root if unspecified
-        if node is None:
-            node = self.root
+        if isinstance(target_graph, Graph):
+            self.target_graph._scream_if_not_simple()
 
-        children_results = []
+        # The Numba kernels work on int64 tables, which are exact whenever
+        # every count fits in 64 bits; otherwise we use Python integers
+        self.int64_tables = fits_int64_tables(self.actual_target_size, len(graph))
+        self.kernel_adjacency = dense_adjacency(self.actual_target_graph)
 
-        for child in self.dir_labelled_TD.neighbors_out(node):
-            children_results.append(self.count_homomorphisms_parallel(child))
+        # What the tasks get instead of this counter: see `helpers/task_specs.py`
+        self.shared_target = SharedTarget(self.kernel_adjacency, target_clr if colourful else None, target_dir)
 
-        node_type = self.dir_labelled_TD.get_vertex(node)
+        # The decomposition only depends on the pattern, so it may be shared
+        # between counters, see `helpers/plan.py`
+        if plan is None:
+            plan = PatternPlan(graph)
+        elif plan.graph != graph:
+            raise ValueError("the plan was made for another pattern")
 
-        match node_type:
-            case 'intro':
-                return delayed(self._add_intro_node_parallel)(node, children_results[0])
-            case 'forget':
-                return delayed(self._add_forget_node_parallel)(node, children_results[0])
-            case 'join':
-                return delayed(self._add_join_node_parallel)(children_results[0], children_results[1])
-            case _:
-                return delayed(self._add_leaf_node_parallel)(node)
+        self.plan = plan
+        self.tree_decomp = plan.tree_decomp
+        self.nice_tree_decomp = plan.nice_tree_decomp
+        self.root = plan.root
+        self.dir_labelled_TD = plan.dir_labelled_TD
+        self.node_changes_dict = plan.node_changes_dict
 
-    ### Main adding functions
 
-    def _add_leaf_node_parallel(self, node):
+    def explain(self, print_tree=True, operations_per_second=OPERATIONS_PER_SECOND):
         r"""
-        Add the leaf node to the DP table and update it accordingly.
+        Return the predicted cost of a count, without running it.
+
+        See :meth:`~standard_hom_count.GraphHomomorphismCounter.explain`. The
+        engines of this class release a table once its parent is computed: their
+        peak memory is ``peak_live_bytes``, per task chain when tasks run in parallel.
         """
-        return [1]
+        estimate = estimate_count(self, operations_per_second)
+        if print_tree:
+            print(estimate.format_tree())
+        return estimate
 
-    def _add_intro_node_parallel(self, node, child_result):
+    def count_homomorphisms_parallel(self, node=None, fusion_threshold=FUSION_THRESHOLD, shared_memory=False,
+                                     checkpoint_dir=None, export=None, resume_from=None, trace=None, memory=None):
         r"""
-        Add the intro node to the DP table and update it accordingly.
+        Return the DP table of ``node`` (by default the root) as a Dask delayed object.
+
+        The root has an empty bag, so its table is a single entry: the number
+        of homomorphisms. Call ``.compute()`` on the result to run the count.
+
+        Every maximal chain of nodes, and every subtree whose predicted work is
+        at most ``fusion_threshold`` table entries, is fused into a single Dask
+        task; see :meth:`build_task_graph`.
+
+        With ``shared_memory=True``, the tasks exchange their tables through
+        shared memory segments instead of pickling them, which pays off with
+        Dask's process scheduler, ``.compute(scheduler='processes')``; see
+        `helpers/shared_tables.py`.
+
+        With ``checkpoint_dir``, the table computed by every task is saved to
+        that directory by a write task of its own, which no computing task
+        waits for (the result waits for all of them), and a count restarted with the same
+        directory skips every task whose table, or whose ancestor's table, is
+        already saved; see `helpers/checkpoint.py`.
+
+        With ``export``, a :class:`~helpers.table_export.TableExport`, every
+        node it selects starts its own task, whose table is exported. With
+        ``resume_from``, an export of this count, every exported node starts
+        its own task, whose table is loaded instead; see `helpers/table_export.py`. Tables are laid out as in
+        :class:`~standard_hom_count.GraphHomomorphismCounter`, so the engines
+        can resume from, and be compared with, each other's tables.
+
+        With ``trace``, a :class:`~helpers.tracing.Trace`, every node is
+        recorded as its task runs; use a threaded scheduler, the default, as
+        tasks run by other processes raise ``RuntimeError``. See
+        `helpers/tracing.py`.
+
+        With ``memory``, a :class:`~helpers.memory_profile.MemoryProfile`, every
+        table is accounted for as its task computes it and releases its
+        children, with the same caveat; see `helpers/memory_profile.py`.
         """
-        # Basic setup
-        node_index, node_vertices = node
-        node_vtx_tuple = tuple(node_vertices)
-
-        child_node_index, child_node_vtx = self.dir_labelled_TD.neighbors_out(node)[0]
-        child_node_vtx_tuple = tuple(child_node_vtx)
-
-        # If `colourful` is True, we can reduce the size of each DP table entry,
-        # since we only need to consider colour partitions: Each vertex with some
-        # colour in G should only map to its colour partition class in H.
-        # if self.colourful:
-        #     node_clr_counter = count_occurrences([self.graph_clr[i] for i in node_vtx_tuple])
-        #     target_clr_counter = count_occurrences(self.target_clr)
-        #     clr_intersection = list_intersection(node_clr_counter, self.target_clr) # relevant colours
-        #     # print("Colours: ", node_clr_counter, target_clr_counter, clr_intersection)
-
-        #     # Filter target vertices based on colour intersection and create subgraph
-        #     target_vertices_to_keep = [v for v in self.target_graph.vertices() if self.target_clr[v] in clr_intersection]
-        #     self.actual_target_graph = self.target_graph.subgraph(target_vertices_to_keep)
-        #     # print("actual target graph: ", self.actual_target_graph.edges())
-
-        #     self.actual_target_size = len(self.actual_target_graph)
-        #     # print("actual target size: ", self.actual_target_size)
-
-        #     mappings_length = prod(target_clr_counter[i] ** node_clr_counter[i] for i in clr_intersection)
-        #     # mappings_length = len(self.target_graph) ** len(node_vtx_tuple)
-        # else:
-        mappings_length = self.actual_target_size ** len(node_vtx_tuple)
-        # print("target size", self.actual_target_size)
-        # print("mappings length: ", mappings_length)
-
-        mappings_count = [0 for _ in range(mappings_length)]
-
-        # Use the adjacency matrix when dense, otherwise use the graph itself
-        target_density = self.actual_target_graph.density()
-        target = self.actual_target_graph.adjacency_matrix() if target_density >= self.density_threshold else self.actual_target_graph
-
-        # Intro node specifically
-        intro_vertex = self.node_changes_dict[node_index]
-        intro_vtx_index = node_vtx_tuple.index(intro_vertex) # Index of the intro vertex in the node/bag
-        # print("intro vertex {} and its index {} in bag".format(intro_vertex, intro_vtx_index))
-
-        if self.colourful:
-            intro_vtx_clr = self.graph_clr[intro_vertex]
-            # print("intro vtx clr", intro_vtx_clr)
-
-        # Neighborhood of intro vertex in the bag
-        intro_vtx_nbhs = [child_node_vtx_tuple.index(vtx) for vtx in child_node_vtx_tuple if self.graph.has_edge(intro_vertex, vtx)]
-        # intro_vtx_nbhs = [self.graph.index(vtx) for vtx in child_node_vtx_tuple if self.graph.has_edge(intro_vertex, vtx)]
-        # print("intro node nbhs in bag: ", intro_vtx_nbhs)
-
-        # child_DP_entry = self.DP_table[child_node_index]
-        # print("INTRO child DP entry: ", child_DP_entry)
-        # print("\n")
-
-        for mapped in range(len(child_result)):
-            # Neighborhood of the mapped vertices of intro vertex in the target graph
-            mapped_intro_nbhs = [extract_bag_vertex(mapped, vtx, self.actual_target_size) for vtx in intro_vtx_nbhs]
-            # print("mapped: ", mapped)
-            # print("mapped nbhs in target: ", mapped_intro_nbhs)
-
-            mapping = add_vertex_into_mapping(0, mapped, intro_vtx_index, self.actual_target_size)
-
-            for target_vtx in self.actual_target_graph:
-                # print("target vertex: ", target_vtx)
-
-                # If the colours do not match, skip current iteration and
-                # move on to the next vertex
-                if self.colourful:
-                    target_vtx_clr = self.target_clr[target_vtx]
-                    # print("intro color: {}, target color: {}".format(intro_vtx_clr, target_vtx_clr))
-                    if intro_vtx_clr != target_vtx_clr:
-                        mapping += self.actual_target_size ** intro_vtx_index
-                        continue
-
-                # print("current mapping", mapping)
-                if is_valid_mapping(target_vtx, mapped_intro_nbhs, target):
-                    # print("VALID!")
-                    mappings_count[mapping] = child_result[mapped]
-
-                mapping += self.actual_target_size ** intro_vtx_index
-                # print("TEMP entry: {}\n".format(mappings_count))
-
-        return mappings_count
-
-    def _add_forget_node_parallel(self, node, child_result):
-        r"""
-        Add the forget node to the DP table and update it accordingly.
-        """
-        # Basic setup
-        node_index, node_vertices = node
-        node_vtx_tuple = tuple(node_vertices)
+        if shared_memory and (checkpoint_dir, export, resume_from, trace, memory) != (None,) * 5:
+            raise ValueError("checkpoints, exports, traces and memory profiles are not supported "
+                             "with shared memory tables")
+        if checkpoint_dir is not None and resume_from is not None:
+            raise ValueError("a count resumes either from a checkpoint or from exported tables")
+
+        export = None if export is None else export.bind(self)
+        resume_from = None if resume_from is None else resume_from.bind(self)
+        task_roots = {current for current in self.dir_labelled_TD
+                      if (export is not None and export.wants(current[0]))
+                      or (resume_from is not None and resume_from.has(f"node-{current[0]}"))}
+
+        tasks = self.build_task_graph(node, fusion_threshold, task_roots)
+        checkpoint = None if checkpoint_dir is None else counter_checkpoint(self, checkpoint_dir)
+        table = self._delayed_table(tasks, self.task_specs(tasks), shared_memory, checkpoint, export, resume_from,
+                                    trace, memory)
+
+        if shared_memory:
+            return delayed(fetch_shared_table)(table)
+        return table
+
+    def _delayed_table(self, tasks, specs, shared_memory=False, checkpoint=None, export=None, resume_from=None,
+                       trace=None, memory=None):
+        r"""
+        Return the table of the first task of ``tasks`` as a Dask delayed object.
+
+        With a ``checkpoint``, saved tables are loaded instead of computed, and
+        the others are saved once computed. Tables exported in ``resume_from``
+        are loaded too, and computed tables of the nodes of ``export`` are exported.
+        Tables are saved and exported by write tasks off the critical path:
+        only the returned table waits for them, and raises their errors.
+        The nodes of every task computed are recorded in ``trace``, and their
+        tables in ``memory``.
+        """
+        run_task = run_shared_task_spec if shared_memory else run_task_spec
+
+        # Tasks below a loaded table are never computed, so nothing of theirs is written
+        computed = [False] * len(tasks)
+        computed[0] = True
+        for task_index, task in enumerate(tasks):
+            name = f"node-{task['root'][0]}"
+            if computed[task_index] and not ((checkpoint is not None and checkpoint.has(name))
+                                             or (resume_from is not None and resume_from.has(name))):
+                for child in task['children']:
+                    computed[child] = True
+
+        # Children tasks are created after their parent, so we go backwards.
+        # The tasks only capture their compact spec, not this counter.
+        # Tasks below a saved table are created, but never computed.
+        delayed_results = [None] * len(tasks)
+        writes = []
+        for task_index in reversed(range(len(tasks))):
+            spec = specs[task_index]
+            children_results = [delayed_results[child] for child in tasks[task_index]['children']]
+            node_index = tasks[task_index]['root'][0]
+            name = f"node-{node_index}"
+
+            if resume_from is not None and resume_from.has(name):
+                delayed_results[task_index] = delayed(resume_from.load)(name, spec.dtype)
+                continue
+
+            task_run = run_task
+            if trace is not None or memory is not None:
+                program = self._task_program(tasks[task_index], tasks)
+                nodes = [(current[0], self.dir_labelled_TD.get_vertex(current), len(current[1]))
+                         for current, _ in program]
+            if trace is not None:
+                task_run = partial(traced_task, trace, [node for node, (_, instruction) in zip(nodes, program)
+                                                        if instruction[0] != 'input'], task_run)
+            if memory is not None:
+                task_run = partial(profiled_task, memory, nodes, task_run)
+
+            if checkpoint is not None and checkpoint.has(name):
+                result = delayed(checkpoint.load)(name, spec.dtype)
+            else:
+                result = delayed(task_run)(spec, *children_results)
+                if checkpoint is not None and computed[task_index]:
+                    writes.append(delayed(checkpoint.write)(name, result))
+
+            if export is not None and export.wants(node_index) and computed[task_index]:
+                writes.append(delayed(export.write)(name, result))
+            delayed_results[task_index] = result
+
+        if not writes:
+            return delayed_results[0]
+        return delayed(after_writes)(delayed_results[0], *writes)
+
+    def count_homomorphisms_sharded(self, num_shards=None, pinned_vertex=None, fusion_threshold=math.inf,
+                                    checkpoint_dir=None):
+        r"""
+        Return the number of homomorphisms, split into independent shards, as a Dask delayed object.
+
+        The target vertices are partitioned into ``num_shards`` shards (by
+        default, one per core) of balanced degree-weighted cost, and each shard
+        runs the full DP with the images of ``pinned_vertex`` (by default, a
+        vertex of maximum degree) restricted to the shard. The shard counts are
+        summed exactly; see `helpers/sharding.py`.
+
+        With the default ``fusion_threshold``, each shard is a single task, so
+        shards only communicate for the final sum: run it with
+        ``.compute(scheduler='processes')`` to spread one count over all
+        cores, or on a ``dask.distributed`` cluster to spread it over several
+        machines. There, the target is scattered once to every worker, unless
+        the counter was given a ``target_dir`` shared by the workers; see
+        :class:`~helpers.task_specs.SharedTarget`.
+
+        With ``checkpoint_dir``, the count of every shard is saved to that
+        directory, and a count restarted with the same directory and shards
+        skips every shard already counted; see `helpers/checkpoint.py`.
+        """
+        pinned_vertex, shards = self.shard_target(num_shards, pinned_vertex)
+        tasks = self.build_task_graph(fusion_threshold=fusion_threshold)
+        dtype = np.int64 if self.int64_tables else object
+
+        checkpoint = None
+        if checkpoint_dir is not None:
+            checkpoint = counter_checkpoint(self, checkpoint_dir,
+                                            plan={'pinned_vertex': repr(pinned_vertex), 'shards': shards})
+
+        shard_tables = []
+        writes = []
+        for shard_index, shard in enumerate(shards):
+            name = f"shard-{shard_index}"
+            if checkpoint is not None and checkpoint.has(name):
+                shard_tables.append(delayed(checkpoint.load)(name, dtype))
+                continue
+
+            domain = np.zeros(self.actual_target_size, dtype=np.uint8)
+            domain[shard] = 1
+            shard_table = self._delayed_table(tasks, self.task_specs(tasks, pinned_vertex, domain))
+            shard_tables.append(shard_table)
+            if checkpoint is not None:
+                writes.append(delayed(checkpoint.write)(name, shard_table))
+
+        total = delayed(sum)(shard_tables, np.zeros(1, dtype=dtype))
+        return total if not writes else delayed(after_writes)(total, *writes)
+
+    def shard_target(self, num_shards=None, pinned_vertex=None):
+        r"""
+        Return ``(pinned_vertex, shards)``, the shards of target vertices used by :meth:`count_homomorphisms_sharded`.
 
-        child_node_index, child_node_vtx = self.dir_labelled_TD.neighbors_out(node)[0]
-        child_node_vtx_tuple = tuple(child_node_vtx)
+        Target vertices to which ``pinned_vertex`` cannot be mapped, because of
+        colours, are left out of every shard.
+        """
+        if pinned_vertex is None:
+            pinned_vertex = pinned_vertex_choice(self.graph)
+        if num_shards is None:
+            num_shards = os.cpu_count()
 
-        # target_graph_size = len(self.target_graph)
-        mappings_length_range = range(self.actual_target_size ** len(node_vtx_tuple))
-        mappings_count = [0 for _ in mappings_length_range]
-        # print("FORGET DP table length: ", mappings_length_range)
+        allowed = self.shared_target.allowed(self.graph_clr[pinned_vertex] if self.colourful else None)
+        weights = image_weights(self.kernel_adjacency.sum(axis=1, dtype=np.int64), self.graph.degree(pinned_vertex))
+        vertices = [vertex for vertex in range(self.actual_target_size) if allowed[vertex]]
 
-        # Forget node specifically
-        forgotten_vtx = self.node_changes_dict[node_index]
-        forgotten_vtx_index = child_node_vtx_tuple.index(forgotten_vtx)
+        return pinned_vertex, balanced_shards(vertices, weights, num_shards)
 
-        for mapping in mappings_length_range:
-            sum = 0
-            # extended_mapping = add_vertex_into_mapping(0, mapping, forgotten_vtx_index, target_graph_size)
-            extended_mapping = add_vertex_into_mapping(0, mapping, forgotten_vtx_index, self.actual_target_size)
+    def count_homomorphisms_in_process_pool(self, max_workers=None, node=None, fusion_threshold=FUSION_THRESHOLD):
+        r"""
+        Return the DP table of ``node`` (by default the root), computed by a pool of worker processes.
 
-            for target_vtx in self.target_graph:
-            # for target_vtx in self.actual_target_graph:
-                # print("FORGET extended mapping: ", extended_mapping)
-                sum += child_result[extended_mapping]
-                extended_mapping += self.actual_target_size ** forgotten_vtx_index
+        This runs the tasks of :meth:`build_task_graph` without Dask, on a
+        `concurrent.futures.ProcessPoolExecutor` of ``max_workers`` processes
+        (by default, one per core), with the tables in shared memory.
+        """
+        tasks = self.build_task_graph(node, fusion_threshold)
+        return run_in_process_pool(self.task_specs(tasks), [task['children'] for task in tasks], max_workers)
+
+    def count_homomorphisms_work_stealing(self, num_workers=None, node=None, split_threshold=SPLIT_THRESHOLD):
+        r"""
+        Return the DP table of ``node`` (by default the root), computed by a built-in work-stealing scheduler.
+
+        The nodes run directly on ``num_workers`` threads (by default, one per
+        core), without Dask; leaves on the critical path start first, and nodes
+        predicted to touch more than ``split_threshold`` table entries are
+        split into pieces; see `helpers/work_stealing.py`.
+        """
+        return self._run_work_stealing(num_workers, node, split_threshold)
+
+    async def count_homomorphisms_async(self, deadline=None, progress=None, executor=None, num_workers=None,
+                                        split_threshold=SPLIT_THRESHOLD):
+        r"""
+        Return the DP table of the root, computed by the work-stealing scheduler without blocking the event loop.
 
-            mappings_count[mapping] = sum
+        INPUT:
 
-        return mappings_count
+        - ``deadline`` (default: None) -- the time, in the clock of the running
+          loop (``loop.time()``), after which the count is cancelled and
+          `asyncio.TimeoutError` is raised
 
+        - ``progress`` (default: None) -- a function called on the event loop
+          after every node, with the number of nodes done, the number of nodes
+          and the predicted work remaining, in DP table entries
 
-    def _add_join_node_parallel(self, left_child_result, right_child_result):
+        - ``executor`` (default: None) -- the `concurrent.futures.Executor`
+          driving the scheduler, by default the loop's default executor
+
+        - ``num_workers``, ``split_threshold`` -- see :meth:`count_homomorphisms_work_stealing`
+
+        Cancelling the awaiting task, or passing the deadline, stops every
+        worker before its next node or piece of a node, and releases every DP
+        table; see `helpers/async_count.py`.
         """
-        Add the join node to the DP table and update it accordingly.
-        Assumes left_child_result and right_child_result are the computed results
-        from the two child nodes.
+        return await run_in_worker(lambda cancel, report: self._run_work_stealing(num_workers, None, split_threshold,
+                                                                                  cancel, report),
+                                   deadline, progress, executor)
+
+    def _run_work_stealing(self, num_workers=None, node=None, split_threshold=SPLIT_THRESHOLD, cancel=None,
+                           report=None):
+        if node is None:
+            node = self.root
+
+        post_order = self._post_order(node)
+        children = {current: self.dir_labelled_TD.neighbors_out(current) for current in post_order}
+        instructions = {current: self._node_instruction(current) for current in post_order}
+        node_work = {current: self._node_work(current) for current in post_order}
+
+        # Priority: the predicted work on the path from a node up to `node`
+        priority = {}
+        for current in reversed(post_order):
+            priority[current] = node_work[current] + sum(priority[parent] for parent
+                                                         in self.dir_labelled_TD.neighbors_in(current)
+                                                         if parent in priority)
+
+        on_node_done = None
+        if report is not None:
+            progress_lock = threading.Lock()
+            done = [0, sum(node_work.values())]
+
+            def on_node_done(current):
+                with progress_lock:
+                    done[0] += 1
+                    done[1] -= node_work[current]
+                    report(done[0], len(post_order), done[1])
+
+        return run_work_stealing(node, children, instructions, priority, self.shared_target,
+                                 'int64' if self.int64_tables else 'object', num_workers=num_workers,
+                                 split_threshold=split_threshold, cancel=cancel, on_node_done=on_node_done)
+
+    def count_homomorphisms_dask_array(self, node=None, chunk_entries=CHUNK_ENTRIES):
+        r"""
+        Return the DP table of ``node`` (by default the root) as a lazy, chunked `dask.array`.
+
+        Every table of the subtree is a dask array split into blocks of at most
+        ``chunk_entries`` entries, so that a single large node runs on all cores
+        and tables larger than memory are computed block by block; see
+        `helpers/dask_tables.py`. Call ``.compute()`` on the result to run the count.
+        """
+        # A single task covers the whole subtree
+        (spec,) = self.task_specs(self.build_task_graph(node, fusion_threshold=math.inf))
+        return dask_table(spec, chunk_entries).reshape(-1)
+
+    def build_task_graph(self, node=None, fusion_threshold=FUSION_THRESHOLD, task_roots=()):
+        r"""
+        Group the nodes of the subtree of ``node`` (by default the root) into coarse tasks.
+
+        A child of a join node starts a new task when the predicted work of its
+        subtree exceeds ``fusion_threshold`` table entries; every other node
+        belongs to the task of its parent. Hence every single-child chain is
+        fused, and small subtrees are not worth the scheduling overhead of
+        separate tasks. The tree is walked iteratively, so long chains do not
+        hit Python's recursion limit. Every node of ``task_roots`` also starts
+        a new task, so that its table is materialised.
+
+        OUTPUT:
+
+        - a list of tasks, the first one containing ``node``. Each task is a
+          dictionary with keys ``root`` (its topmost node), ``nodes`` (its nodes,
+          children before parents), ``children`` (indices of the tasks it
+          depends on), ``work`` (its predicted work) and ``critical_path``
+          (the predicted work of the longest chain of tasks it starts).
+
+        The summary of the last graph built is kept in ``self.task_graph_stats``.
+        """
+        if node is None:
+            node = self.root
+
+        post_order = self._post_order(node)
+
+        node_work = {}
+        subtree_work = {}
+        for current in post_order:
+            node_work[current] = self._node_work(current)
+            subtree_work[current] = node_work[current] + sum(subtree_work[child] for child
+                                                             in self.dir_labelled_TD.neighbors_out(current))
+
+        # Parents before children, so the task of a node's parent is known
+        tasks = [{'root': node, 'nodes': [], 'children': [], 'work': 0}]
+        task_of = {node: 0}
+        for current in reversed(post_order):
+            is_join = self.dir_labelled_TD.get_vertex(current) == 'join'
+
+            for child in self.dir_labelled_TD.neighbors_out(current):
+                if (is_join and subtree_work[child] > fusion_threshold) or child in task_roots:
+                    task_of[child] = len(tasks)
+                    tasks[task_of[current]]['children'].append(len(tasks))
+                    tasks.append({'root': child, 'nodes': [], 'children': [], 'work': 0})
+                else:
+                    task_of[child] = task_of[current]
+
+        for current in post_order:
+            task = tasks[task_of[current]]
+            task['nodes'].append(current)
+            task['work'] += node_work[current]
+
+        for task in reversed(tasks):
+            task['critical_path'] = task['work'] + max((tasks[child]['critical_path'] for child in task['children']),
+                                                       default=0)
+
+        self.task_graph_stats = {
+            'nodes': len(post_order),
+            'tasks': len(tasks),
+            'total_work': subtree_work[node],
+            'critical_path_work': tasks[0]['critical_path'],
+        }
+
+        return tasks
+
+    def _post_order(self, node):
+        r"""
+        Return the nodes of the subtree of ``node``, children first, with an explicit stack.
+        """
+        post_order = []
+        stack = [(node, False)]
+        while stack:
+            current, expanded = stack.pop()
+            if expanded:
+                post_order.append(current)
+            else:
+                stack.append((current, True))
+                stack.extend((child, False) for child in self.dir_labelled_TD.neighbors_out(current))
+
+        return post_order
+
+    def _node_work(self, node):
+        r"""
+        Return the predicted work of ``node``, in DP table entries touched.
         """
-        # chunk_size = len(left_child_result) // 10
-        # dask_left = da.from_array(left_child_result, chunks=chunk_size)
-        # dask_right = da.from_array(right_child_result, chunks=chunk_size)
+        return predicted_node_work(self.dir_labelled_TD.get_vertex(node), len(get_node_content(node)),
+                                   self.actual_target_size)
+
+    def task_specs(self, tasks, pinned_vertex=None, domain=None):
+        r"""
+        Return the compact :class:`~helpers.task_specs.TaskSpec` of each task of ``tasks``.
+
+        If ``domain`` is given, the images of ``pinned_vertex`` are restricted to it.
+        """
+        dtype = 'int64' if self.int64_tables else 'object'
+        return [TaskSpec(tuple(instruction for _, instruction in self._task_program(task, tasks, pinned_vertex)),
+                         self.shared_target, dtype, domain) for task in tasks]
+
+    def _task_program(self, task, tasks, pinned_vertex=None):
+        r"""
+        Return the program of ``task`` as a list of pairs ``(node, instruction)``.
+        """
+        child_task_roots = {tasks[child]['root']: input_index
+                            for input_index, child in enumerate(task['children'])}
+
+        # Post-order walk of the task, stopping at the roots of other tasks
+        program = []
+        stack = [(task['root'], False)]
+        while stack:
+            current, expanded = stack.pop()
+            if current in child_task_roots and current != task['root']:
+                program.append((current, ('input', child_task_roots[current])))
+            elif expanded:
+                program.append((current, self._node_instruction(current, pinned_vertex)))
+            else:
+                stack.append((current, True))
+                stack.extend((child, False) for child in self.dir_labelled_TD.neighbors_out(current))
+
+        return program
+
+    def task_payload_sizes(self, node=None, fusion_threshold=FUSION_THRESHOLD):
+        r"""
+        Return the number of bytes pickled for each task of :meth:`count_homomorphisms_parallel`.
+
+        The shared target is pickled as a handle; it is written to a file, or
+        scattered to the ``dask.distributed`` workers, once, and loaded once
+        per worker process, see :class:`~helpers.task_specs.SharedTarget`.
+        """
+        specs = self.task_specs(self.build_task_graph(node, fusion_threshold))
+        return [len(pickle.dumps(spec)) for spec in specs]
+
+    def _node_instruction(self, node, pinned_vertex=None):
+        r"""
+        Return the stack machine instruction computing the DP table of ``node``.
+        """
+        node_index, node_vertices = node
+        node_type = self.dir_labelled_TD.get_vertex(node)
 
-        # mappings_count = dask_left * dask_right
+        if node_type not in ('intro', 'forget'):
+            return (node_type if node_type == 'join' else 'leaf',)
 
-        # # mappings_count = [left * right for left, right in zip(left_child_result, right_child_result)]
-        # # print("Left length: ", len(left_child_result))
-        # # print("Right length: ", len(right_child_result))
-        # return mappings_count.compute()
+        child_node_vtx_tuple = tuple(self.dir_labelled_TD.neighbors_out(node)[0][1])
+        changed_vertex = self.node_changes_dict[node_index]
 
-        @jit(nopython=True, parallel=True)
-        def multiply_elements(left, right):
-            return left * right
+        if node_type == 'forget':
+            return ('forget', len(child_node_vtx_tuple), child_node_vtx_tuple.index(changed_vertex))
 
-        left_array = np.array(left_child_result)
-        right_array = np.array(right_child_result)
-        results = multiply_elements(left_array, right_array)
+        intro_vtx_nbhs = tuple(child_node_vtx_tuple.index(vtx) for vtx in child_node_vtx_tuple
+                               if self.graph.has_edge(changed_vertex, vtx))
+        colour = self.graph_clr[changed_vertex] if self.colourful else None
 
-        return results
+        return ('intro', len(child_node_vtx_tuple), tuple(node_vertices).index(changed_vertex), intro_vtx_nbhs, colour,
+                changed_vertex == pinned_vertex)
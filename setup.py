@@ -0,0 +1,35 @@
+r"""
+Build the optional compiled DP kernels in place::
+
+    python setup.py build_ext --inplace
+
+(use ``sage -python`` to build them for Sage's own Python). Without them, the
+counters run on their pure-Python code paths, with the same results.
+"""
+import sys
+
+import numpy as np
+from Cython.Build import cythonize
+from setuptools import Extension, setup
+
+# MSVC spells OpenMP differently, and Apple's clang needs libomp installed
+if sys.platform == "win32":
+    compile_args, link_args = ["/O2", "/openmp"], []
+else:
+    compile_args, link_args = ["-O3", "-fopenmp"], ["-fopenmp"]
+
+extensions = [
+    Extension(
+        "helpers._dp_kernels",
+        ["helpers/_dp_kernels.pyx"],
+        include_dirs=[np.get_include()],
+        define_macros=[("NPY_NO_DEPRECATED_API", "NPY_1_7_API_VERSION")],
+        extra_compile_args=compile_args,
+        extra_link_args=link_args,
+    ),
+]
+
+setup(
+    name="count-graph-homs",
+    ext_modules=cythonize(extensions),
+)
@@ -1,29 +1,67 @@
 from sage.graphs.graph import Graph
 
+import numpy as np
+import time
+
 from helpers.nice_tree_decomp import *
+from helpers.plan import PatternPlan
+from helpers.subgraph_basis import subgraph_basis
 from helpers.help_functions import *
+from helpers.prepared_target import PreparedTarget, BitsetTarget, ConvertedTarget
+from helpers.dp_kernels import *
+from helpers.array_kernels import digit_axis
+from helpers.checkpoint import counter_checkpoint
+from helpers.async_count import CountCancelled, check_cancelled, run_in_worker
+from helpers.rooted_output import ROOTED_BLOCK_SIZE, write_rooted_block
+from helpers.explain import OPERATIONS_PER_SECOND, estimate_count
+from helpers.autotune import machine_profile, threaded_kernels
 
 # In integer rep, the DP table is of the following form:
 # { node_index: [1, 2, 3, 4, 5],
 #   second_node_index: [10, 20, 30, 40, 50], ...}
 
 class GraphHomomorphismCounter:
-    def __init__(self, graph, target_graph, density_threshold=0.5, graph_clr=None, target_clr=None, colourful=False):
+    def __init__(self, graph, target_graph, density_threshold=None, graph_clr=None, target_clr=None, colourful=False,
+                 plan=None, cache=None, profile=None, converted=None):
         r"""
         INPUT:
 
         - ``graph`` -- a Sage graph
 
-        - ``target_graph`` -- the graph to which ``graph`` is sent
+        - ``target_graph`` -- the graph to which ``graph`` is sent, either a Sage graph
+          or a :class:`~helpers.prepared_target.PreparedTarget` (e.g. read by `helpers.graph_io`)
 
-        - ``density_threshold`` (default: 0.5) -- the desnity threshold for `target_graph` representation
+        - ``density_threshold`` (default: None) -- the desnity threshold for `target_graph` representation;
+          by default that of ``profile`` for the kind of `target_graph`, or 0.5 without a profile
 
         - ``graph_clr`` (default: None) -- a list of integers representing the colours of the vertices of `graph`
 
         - ``target_clr`` (default: None) -- a list of integers representing the colours of the vertices of `target_graph`
 
         - ``colourful`` (default: False) -- whether the graph homomorphism is colour-preserving
+
+        - ``plan`` (default: None) -- the :class:`~helpers.plan.PatternPlan` of ``graph``,
+          to reuse its tree decomposition; computed if not given
+
+        - ``cache`` (default: None) -- a :class:`~helpers.result_cache.ResultCache`;
+          a count found in it is returned without computing any decomposition,
+          and a computed count is stored in it
+
+        - ``profile`` (default: None) -- a :class:`~helpers.autotune.MachineProfile`,
+          or ``'auto'`` for the profile of this host (measured on first use);
+          it gives the default ``density_threshold``, and picks the kernel of every node
+          with int64 tables, see `helpers/autotune.py`
+
+        - ``converted`` (default: None) -- a :class:`~helpers.prepared_target.ConvertedTarget`
+          of ``target_graph`` with the same ``density_threshold``, to share the
+          conversions of the target between counters
         """
+        if profile == 'auto':
+            profile = machine_profile()
+        if density_threshold is None:
+            density_threshold = 0.5 if profile is None else profile.density_threshold(target_graph)
+        self.profile = profile
+
         self.graph = graph
         self.target_graph = target_graph
         self.density_threshold = density_threshold
@@ -37,33 +75,64 @@ class GraphHomomorphismCounter:
 
         if not isinstance(graph, Graph):
             raise ValueError("first argument must be a sage Graph")
-        if not isinstance(target_graph, Graph):
-            raise ValueError("second argument must be a sage Graph")
+        if not isinstance(target_graph, (Graph, PreparedTarget)):
+            raise ValueError("second argument must be a sage Graph or a PreparedTarget")
 
         if colourful and (graph_clr is None or target_clr is None):
             raise ValueError("Both graph_clr and target_clr must be provided when colourful is True")
 
         self.graph._scream_if_not_simple()
-        self.target_graph._scream_if_not_simple()
-
-        self.tree_decomp = graph.treewidth(certificate=True)
-        self.nice_tree_decomp = make_nice_tree_decomposition(graph, self.tree_decomp)
-        self.root = sorted(self.nice_tree_decomp)[0]
-
-        # Make it into directed graph for better access
-        # to children and parent, if needed
-        #
-        # Each node in a labelled nice tree decomposition
-        # has the following form:
-        #
-        # (node_index, bag_vertices) node_type
-        #
-        # Example: (5, {0, 4}) intro
-        self.dir_labelled_TD = label_nice_tree_decomposition(self.nice_tree_decomp, self.root, directed=True)
-
-        # `node_changes_dict` is responsible for recording introduced and
-        # forgotten vertices in a nice tree decomposition
-        self.node_changes_dict = node_changes(self.dir_labelled_TD)
+        if isinstance(target_graph, Graph):
+            self.target_graph._scream_if_not_simple()
+
+        # Convert the target once, to a dense bitset or to the neighbour sets of
+        # a prepared target, so that intro nodes never go through the generic graph API
+        if converted is None:
+            converted = ConvertedTarget(self.actual_target_graph, density_threshold)
+        elif converted.target_graph is not target_graph or converted.density_threshold != density_threshold:
+            raise ValueError("the converted target was made for another target or density threshold")
+        self.converted = converted
+        self.target = converted.target
+        self._python_backend = 'python-bitset' if isinstance(self.target, BitsetTarget) else 'python-sparse'
+
+        # With the compiled kernels, the DP tables are int64 numpy arrays until
+        # an entry no longer fits in 64 bits, and then lists of Python integers
+        self.compiled_kernels = HAVE_COMPILED_KERNELS
+        self._kernel_adjacency = None
+
+        # The threaded Numba kernels do not detect overflows, so a profile
+        # only picks them when every entry fits in 64 bits
+        self._threaded_kernels_exact = self.actual_target_size ** len(graph) < 2**63
+        self._node_backend = None
+
+        # A cached count needs no decomposition, see `helpers/result_cache.py`
+        self.cache = cache
+        self._cached_count = None
+        if cache is not None:
+            self._cache_key = cache.key(graph, target_graph, 'colourful' if colourful else 'hom', graph_clr, target_clr)
+            self._cached_count = cache.get(self._cache_key)
+
+        # The decomposition only depends on the pattern, so it may be shared
+        # between counters, see `helpers/plan.py`
+        if plan is None and self._cached_count is None:
+            plan = PatternPlan(graph)
+        elif plan is not None and plan.graph != graph:
+            raise ValueError("the plan was made for another pattern")
+
+        self.plan = None
+        if plan is not None:
+            self._use_plan(plan)
+
+    def _use_plan(self, plan):
+        r"""
+        Take the decomposition of the :class:`~helpers.plan.PatternPlan` ``plan``, and reset the DP table.
+        """
+        self.plan = plan
+        self.tree_decomp = plan.tree_decomp
+        self.nice_tree_decomp = plan.nice_tree_decomp
+        self.root = plan.root
+        self.dir_labelled_TD = plan.dir_labelled_TD
+        self.node_changes_dict = plan.node_changes_dict
 
         # `DP_table` is a vector/list of dictionaries
         # Each element (dict) corresponds to the (induced) hom's of a tree node.
@@ -80,7 +149,7 @@ class GraphHomomorphismCounter:
         self.DP_table = [{} for _ in range(len(self.dir_labelled_TD))]
 
 
-    def count_homomorphisms(self):
+    def count_homomorphisms(self, checkpoint_dir=None, export=None, resume_from=None, trace=None, memory=None):
         r"""
         Return the number of homomorphisms from the graph `G` to the graph `H`.
 
@@ -94,6 +163,27 @@ class GraphHomomorphismCounter:
 
         This is an implementation based on the proof of Prop. 1.6 in [CDM2017]_.
 
+        INPUT:
+
+        - ``checkpoint_dir`` (default: None) -- a directory where every DP table
+          is saved as soon as it is computed, in the background; a count
+          restarted with the same directory skips every table already saved.
+          See `helpers/checkpoint.py`.
+
+        - ``export`` (default: None) -- a :class:`~helpers.table_export.TableExport`,
+          into which the tables of its nodes are written in the background,
+          with their bags, for analysis
+
+        - ``resume_from`` (default: None) -- a :class:`~helpers.table_export.TableExport`
+          of this count; its topmost tables are loaded instead of computing
+          their subtrees
+
+        - ``trace`` (default: None) -- a :class:`~helpers.tracing.Trace`, in
+          which every node computed is recorded
+
+        - ``memory`` (default: None) -- a :class:`~helpers.memory_profile.MemoryProfile`,
+          in which every table computed is accounted for
+
         OUTPUT:
 
         - an integer, the number of homomorphisms from `graph` to `target_graph`
@@ -106,10 +196,237 @@ class GraphHomomorphismCounter:
             sage: count_homomorphisms(graph, target_graph)
             324
         """
+        return self._count_homomorphisms(checkpoint_dir, export=export, resume_from=resume_from, trace=trace,
+                                         memory=memory)
+
+    def count_rooted_homomorphisms(self, root_vertex=None):
+        r"""
+        Return the number of homomorphisms sending ``root_vertex`` to each vertex of the target graph.
+
+        INPUT:
+
+        - ``root_vertex`` (default: None) -- a vertex of `graph`; by default,
+          the root vertex of the plan given to the constructor
+
+        OUTPUT:
+
+        - a list of integers, whose `v`-th entry is the number of homomorphisms
+          from `graph` to `target_graph` sending ``root_vertex`` to `v`
+
+        The DP runs on a decomposition with ``root_vertex`` in every bag, see
+        `helpers/plan.py`; if the counter was built with another plan, a
+        rooted plan replaces it.
+
+        EXAMPLES::
+
+            sage: counter = GraphHomomorphismCounter(graphs.PathGraph(3), graphs.StarGraph(3))
+            sage: counter.count_rooted_homomorphisms(1)
+            [9, 1, 1, 1]
+        """
+        return [int(count) for _, counts in self.iter_rooted_homomorphisms(root_vertex) for count in counts]
+
+    def iter_rooted_homomorphisms(self, root_vertex=None, block_size=ROOTED_BLOCK_SIZE):
+        r"""
+        Iterate over the rooted counts of :meth:`count_rooted_homomorphisms`, by blocks of target vertices.
+
+        INPUT:
+
+        - ``root_vertex`` (default: None) -- as in :meth:`count_rooted_homomorphisms`
+
+        - ``block_size`` (default: ``ROOTED_BLOCK_SIZE``) -- the number of target vertices per block
+
+        OUTPUT:
+
+        - an iterator over pairs ``(start, counts)``, where ``counts`` is a numpy
+          array (int64 when every count fits, else of Python integers) of the
+          counts of the target vertices ``start``, ``start + 1``, ...
+
+        The DP runs when the iteration starts; each block is then reduced from
+        the final table only when it is requested, so the counts are never
+        all held at once. See `helpers/rooted_output.py` to write them out.
+
+        EXAMPLES::
+
+            sage: counter = GraphHomomorphismCounter(graphs.PathGraph(3), graphs.StarGraph(3))
+            sage: [(start, list(counts)) for start, counts in counter.iter_rooted_homomorphisms(1, block_size=3)]
+            [(0, [9, 1, 1]), (3, [1])]
+        """
+        if root_vertex is None:
+            root_vertex = self.plan.root_vertex if self.plan is not None else None
+            if root_vertex is None:
+                raise ValueError("root_vertex must be given, as the plan of this counter is not rooted")
+        if self.plan is None or self.plan.root_vertex != root_vertex:
+            self._use_plan(PatternPlan(self.graph, root_vertex))
+
+        total = self._run_dp()
+
+        # Only forget nodes lie above the one forgetting the root vertex, so
+        # the table of its child counts every homomorphism
+        (forget_node,) = [node for node in self.dir_labelled_TD
+                          if self.dir_labelled_TD.get_vertex(node) == 'forget'
+                          and self.node_changes_dict[node[0]] == root_vertex]
+        child_index, child_vertices = self.dir_labelled_TD.neighbors_out(forget_node)[0]
+        bag_size = len(child_vertices)
+
+        # The counts are nonnegative: int64 sums are exact when the total fits
+        table = self.DP_table[child_index]
+        exact = isinstance(table, np.ndarray) and total < 2**63
+        table = np.asarray(table, dtype=np.int64 if exact else object).reshape((self.actual_target_size,) * bag_size)
+        root_axis = digit_axis(bag_size, tuple(child_vertices).index(root_vertex))
+        table = np.moveaxis(table, root_axis, 0)
+
+        for start in range(0, self.actual_target_size, block_size):
+            block = table[start:start + block_size]
+            yield start, block.reshape(len(block), -1).sum(axis=1)
+
+    def write_rooted_homomorphisms(self, out, root_vertex=None, modulus=None, block_size=ROOTED_BLOCK_SIZE):
+        r"""
+        Write the rooted counts of :meth:`count_rooted_homomorphisms` to ``out``, block by block.
+
+        INPUT:
+
+        - ``out`` -- a numpy array with an entry per target vertex, typically a
+          memory map, or a :class:`~helpers.rooted_output.VarintBlobWriter`
+
+        - ``root_vertex`` (default: None) -- as in :meth:`count_rooted_homomorphisms`
+
+        - ``modulus`` (default: None) -- if given, the counts are written modulo ``modulus``
+
+        - ``block_size`` (default: ``ROOTED_BLOCK_SIZE``) -- the number of target vertices per block
+
+        A count too large for the dtype of ``out`` raises ``OverflowError``.
+
+        EXAMPLES::
+
+            sage: counter = GraphHomomorphismCounter(graphs.PathGraph(3), graphs.StarGraph(3))
+            sage: out = np.lib.format.open_memmap("rooted.npy", mode='w+', dtype=np.int64, shape=(4,))  # not tested
+            sage: counter.write_rooted_homomorphisms(out, 1)  # not tested
+            sage: from helpers.rooted_output import VarintBlobWriter, VarintBlob
+            sage: with VarintBlobWriter("rooted.bin", 4) as blob:  # not tested
+            ....:     counter.write_rooted_homomorphisms(blob, 1)
+            sage: list(VarintBlob("rooted.bin"))  # not tested
+            [9, 1, 1, 1]
+        """
+        for start, counts in self.iter_rooted_homomorphisms(root_vertex, block_size):
+            write_rooted_block(out, start, counts, modulus)
+
+    def explain(self, print_tree=True, operations_per_second=None):
+        r"""
+        Return the predicted cost of :meth:`count_homomorphisms`, without running it.
+
+        INPUT:
+
+        - ``print_tree`` (default: True) -- whether to print a tree view of the estimates
+
+        - ``operations_per_second`` (default: None) -- the throughput used to
+          predict the time; by default, that of the profile of this counter,
+          if any, else ``OPERATIONS_PER_SECOND``
+
+        OUTPUT:
+
+        - a :class:`~helpers.explain.CountEstimate`, with the predicted table
+          size, nonzero entries, operations and live memory of every node,
+          flagging the hot nodes; see `helpers/explain.py`. This engine keeps
+          every table until the count returns: its peak memory is ``retained_bytes``.
+
+        EXAMPLES::
+
+            sage: counter = GraphHomomorphismCounter(graphs.CycleGraph(4), graphs.PetersenGraph())
+            sage: estimate = counter.explain(print_tree=False)
+            sage: estimate.nodes[0].type, estimate.nodes[0].entries
+            ('forget', 1)
+        """
+        if self.plan is None:
+            self._use_plan(PatternPlan(self.graph))
+
+        if operations_per_second is None:
+            operations_per_second = (self.profile.operations_per_second if self.profile is not None
+                                     else OPERATIONS_PER_SECOND)
+        estimate = estimate_count(self, operations_per_second)
+        if print_tree:
+            print(estimate.format_tree())
+        return estimate
+
+    async def count_homomorphisms_async(self, deadline=None, progress=None, executor=None, checkpoint_dir=None):
+        r"""
+        Return the number of homomorphisms, counted in a worker thread without blocking the event loop.
+
+        INPUT:
+
+        - ``deadline`` (default: None) -- the time, in the clock of the running
+          loop (``loop.time()``), after which the count is cancelled and
+          `asyncio.TimeoutError` is raised
+
+        - ``progress`` (default: None) -- a function called on the event loop
+          after every node, with the number of nodes done, the number of nodes
+          and the predicted work remaining, in DP table entries
+
+        - ``executor`` (default: None) -- the `concurrent.futures.Executor`
+          running the count, by default the loop's default executor
+
+        - ``checkpoint_dir`` (default: None) -- see :meth:`count_homomorphisms`
+
+        Cancelling the awaiting task, or passing the deadline, stops the count
+        before its next node and releases every DP table; see
+        `helpers/async_count.py`.
+        """
+        return await run_in_worker(lambda cancel, report: self._count_homomorphisms(checkpoint_dir, cancel, report),
+                                   deadline, progress, executor)
+
+    def _count_homomorphisms(self, checkpoint_dir=None, cancel=None, report=None, export=None, resume_from=None,
+                             trace=None, memory=None):
+        r"""
+        Return the cached count, or run the DP and cache its result.
+        """
+        if self._cached_count is not None:
+            return self._cached_count
+
+        count = self._run_dp(checkpoint_dir, cancel, report, export, resume_from, trace, memory)
+        if self.cache is not None:
+            self.cache.put(self._cache_key, count)
+            self._cached_count = count
+        return count
+
+    def _run_dp(self, checkpoint_dir=None, cancel=None, report=None, export=None, resume_from=None, trace=None,
+                memory=None):
+        r"""
+        Run the DP, checking the event ``cancel`` and calling ``report`` after every node, if given.
+
+        Every node computed is recorded in ``trace``, and its table in ``memory``, if given.
+        """
+        if self.plan is None:
+            self._use_plan(PatternPlan(self.graph))
+
+        nodes = self.dir_labelled_TD.vertices()
+        checkpoint = None
+        if checkpoint_dir is not None:
+            checkpoint = counter_checkpoint(self, checkpoint_dir)
+            nodes = self._resume_from_checkpoint(checkpoint)
+        if resume_from is not None:
+            if checkpoint is not None:
+                raise ValueError("a count resumes either from a checkpoint or from exported tables")
+            nodes = self._resume_from_checkpoint(resume_from.bind(self))
+        if export is not None:
+            export.bind(self)
+
+        remaining_work = sum(predicted_node_work(self.dir_labelled_TD.get_vertex(node), len(get_node_content(node)),
+                                                 self.actual_target_size) for node in nodes)
+
         # Whether it's BFS or DFS, every node below join node(s) would be
         # computed first, so we can safely go bottom-up.
-        for node in reversed(self.dir_labelled_TD.vertices()):
+        for nodes_done, node in enumerate(reversed(nodes), start=1):
+            try:
+                check_cancelled(cancel)
+            except CountCancelled:
+                # Release the tables right away
+                self.DP_table = [{} for _ in range(len(self.dir_labelled_TD))]
+                if memory is not None:
+                    memory.release(list(memory.allocations))
+                raise
+
             node_type = self.dir_labelled_TD.get_vertex(node)
+            if trace is not None:
+                start_ns = time.perf_counter_ns()
 
             match node_type:
                 case 'intro':
@@ -122,7 +439,57 @@ class GraphHomomorphismCounter:
                 case _: 
                     self._add_leaf_node_best(node)
 
-        return self.DP_table[0][0]
+            if trace is not None:
+                trace.record(node[0], node_type, len(get_node_content(node)), self.DP_table[node[0]],
+                             start_ns, time.perf_counter_ns(), self._node_backend)
+            if memory is not None:
+                memory.allocate(node[0], node_type, len(get_node_content(node)), self.DP_table[node[0]])
+
+            if checkpoint is not None:
+                checkpoint.save(f"node-{node[0]}", self.DP_table[node[0]])
+            if export is not None and export.wants(node[0]):
+                export.save(f"node-{node[0]}", self.DP_table[node[0]])
+
+            if report is not None:
+                remaining_work -= predicted_node_work(node_type, len(get_node_content(node)), self.actual_target_size)
+                report(nodes_done, len(nodes), remaining_work)
+
+        if checkpoint is not None:
+            checkpoint.flush()
+        if export is not None:
+            export.flush()
+
+        return int(self.DP_table[0][0])
+
+    def _resume_from_checkpoint(self, checkpoint):
+        r"""
+        Load the topmost saved tables of ``checkpoint``, and return the nodes left to compute, sorted.
+
+        ``checkpoint`` may also be a :class:`~helpers.table_export.TableExport`.
+        """
+        to_compute = []
+        stack = [self.root]
+        while stack:
+            node = stack.pop()
+            name = f"node-{node[0]}"
+
+            if checkpoint.has(name):
+                table = checkpoint.load(name)
+                use_kernels = self.compiled_kernels and table.dtype == np.int64
+                self.DP_table[node[0]] = table if use_kernels else table.tolist()
+            else:
+                to_compute.append(node)
+                stack.extend(self.dir_labelled_TD.neighbors_out(node))
+
+        return sorted(to_compute)
+
+    def _int64_backend(self, entries):
+        r"""
+        Return the kernel computing a node with int64 tables of ``entries`` entries, ``'compiled'`` or ``'numba'``.
+        """
+        if self.profile is None or not self._threaded_kernels_exact:
+            return 'compiled'
+        return self.profile.int64_backend(entries)
 
     ### Main adding functions
 
@@ -131,7 +498,8 @@ class GraphHomomorphismCounter:
         Add the leaf node to the DP table and update it accordingly.
         """
         node_index = get_node_index(node)
-        self.DP_table[node_index] = [1]
+        self.DP_table[node_index] = np.ones(1, dtype=np.int64) if self.compiled_kernels else [1]
+        self._node_backend = 'compiled' if self.compiled_kernels else self._python_backend
 
     def _add_intro_node_best(self, node):
         r"""
@@ -146,11 +514,8 @@ class GraphHomomorphismCounter:
 
         mappings_length = self.actual_target_size ** len(node_vtx_tuple)
 
-        mappings_count = [0] * mappings_length
-
-        # Use the adjacency matrix when dense, otherwise use the graph itself
-        target_density = self.actual_target_graph.density()
-        target = self.actual_target_graph.adjacency_matrix() if target_density >= self.density_threshold else self.actual_target_graph
+        neighbour_mask = self.target.neighbour_mask
+        is_valid = self.target.is_valid_masked
 
         # Intro node specifically
         intro_vertex = self.node_changes_dict[node_index]
@@ -164,9 +529,30 @@ class GraphHomomorphismCounter:
 
         child_DP_entry = self.DP_table[child_node_index]
 
+        if isinstance(child_DP_entry, np.ndarray):
+            if self._kernel_adjacency is None:
+                self._kernel_adjacency = self.converted.kernel_adjacency()
+            allowed = allowed_images(self.actual_target_size, self.target_clr if self.colourful else None,
+                                     intro_vtx_clr if self.colourful else None)
+
+            self._node_backend = self._int64_backend(mappings_length)
+            if self._node_backend == 'numba':
+                self.DP_table[node_index] = threaded_kernels().intro_table(
+                    child_DP_entry, self.actual_target_size, intro_vtx_index, intro_vtx_nbhs,
+                    self._kernel_adjacency, allowed, self.profile.chunk_size)
+            else:
+                self.DP_table[node_index] = intro_kernel(child_DP_entry, self.actual_target_size, intro_vtx_index,
+                                                         intro_vtx_nbhs, self._kernel_adjacency, allowed)
+            return
+
+        self._node_backend = self._python_backend
+
+        mappings_count = [0] * mappings_length
+
         for mapped in range(len(child_DP_entry)):
             # Neighborhood of the mapped vertices of intro vertex in the target graph
-            mapped_intro_nbhs = [extract_bag_vertex(mapped, vtx, self.actual_target_size) for vtx in intro_vtx_nbhs]
+            mapped_intro_nbhs = neighbour_mask(extract_bag_vertex(mapped, vtx, self.actual_target_size)
+                                               for vtx in intro_vtx_nbhs)
 
             mapping = add_vertex_into_mapping(0, mapped, intro_vtx_index, self.actual_target_size)
 
@@ -179,7 +565,7 @@ class GraphHomomorphismCounter:
                         mapping += self.actual_target_size ** intro_vtx_index
                         continue
 
-                if is_valid_mapping(target_vtx, mapped_intro_nbhs, target):
+                if is_valid(target_vtx, mapped_intro_nbhs):
                     mappings_count[mapping] = child_DP_entry[mapped]
 
                 mapping += self.actual_target_size ** intro_vtx_index
@@ -199,7 +585,6 @@ class GraphHomomorphismCounter:
 
         target_graph_size = len(self.target_graph)
         mappings_length_range = range(self.actual_target_size ** len(node_vtx_tuple))
-        mappings_count = [0 for _ in mappings_length_range] # TODO [0] * something_length directly
 
         # Forget node specifically
         forgotten_vtx = self.node_changes_dict[node_index]
@@ -207,6 +592,22 @@ class GraphHomomorphismCounter:
 
         child_DP_entry = self.DP_table[child_node_index]
 
+        if isinstance(child_DP_entry, np.ndarray):
+            self._node_backend = self._int64_backend(len(child_DP_entry))
+            if self._node_backend == 'numba':
+                self.DP_table[node_index] = threaded_kernels().forget_table(
+                    child_DP_entry, self.actual_target_size, forgotten_vtx_index, self.profile.chunk_size)
+                return
+            try:
+                self.DP_table[node_index] = forget_kernel(child_DP_entry, self.actual_target_size, forgotten_vtx_index)
+                return
+            except OverflowError:
+                child_DP_entry = exact_table(child_DP_entry)
+
+        self._node_backend = self._python_backend
+
+        mappings_count = [0 for _ in mappings_length_range] # TODO [0] * something_length directly
+
         for mapping in mappings_length_range:
             sum = 0
             # extended_mapping = add_vertex_into_mapping(0, mapping, forgotten_vtx_index, target_graph_size)
@@ -231,7 +632,80 @@ class GraphHomomorphismCounter:
         left_child_index = get_node_index(left_child)
         right_child_index = get_node_index(right_child)
 
+        left_DP_entry = self.DP_table[left_child_index]
+        right_DP_entry = self.DP_table[right_child_index]
+
+        if isinstance(left_DP_entry, np.ndarray) and isinstance(right_DP_entry, np.ndarray):
+            self._node_backend = self._int64_backend(len(left_DP_entry))
+            if self._node_backend == 'numba':
+                self.DP_table[node_index] = threaded_kernels().join_table(left_DP_entry, right_DP_entry)
+                return
+            try:
+                self.DP_table[node_index] = join_kernel(left_DP_entry, right_DP_entry)
+                return
+            except OverflowError:
+                pass
+
+        self._node_backend = self._python_backend
+
         mappings_count = [left_count * right_count for left_count, right_count
-                            in zip(self.DP_table[left_child_index], self.DP_table[right_child_index])]
+                            in zip(exact_table(left_DP_entry), exact_table(right_DP_entry))]
 
         self.DP_table[node_index] = mappings_count
+
+
+def count_subgraphs(graph, target_graph, basis=None, plans=None, cache=None, converted=None):
+    r"""
+    Return the number of subgraphs of ``target_graph`` isomorphic to ``graph``.
+
+    The subgraphs are not necessarily induced. The count is a linear
+    combination of homomorphism counts from the quotients of ``graph``, see
+    `helpers/subgraph_basis.py`.
+
+    INPUT:
+
+    - ``graph`` -- a Sage graph
+
+    - ``target_graph`` -- a Sage graph or a :class:`~helpers.prepared_target.PreparedTarget`
+
+    - ``basis`` (default: None) -- the result of ``subgraph_basis(graph)``, computed if not given
+
+    - ``plans`` (default: None) -- a dictionary from the graph6 strings of
+      quotients to their :class:`~helpers.plan.PatternPlan`, filled as needed,
+      to share the plans between calls
+
+    - ``cache`` (default: None) -- a :class:`~helpers.result_cache.ResultCache`,
+      consulted before counting, and storing the computed count
+
+    - ``converted`` (default: None) -- a :class:`~helpers.prepared_target.ConvertedTarget`
+      of ``target_graph``, shared by the counts of the quotients; made if not given
+
+    EXAMPLES::
+
+        sage: count_subgraphs(graphs.CycleGraph(4), graphs.CompleteGraph(4))
+        3
+    """
+    if cache is not None:
+        key = cache.key(graph, target_graph, 'subgraph')
+        count = cache.get(key)
+        if count is None:
+            count = count_subgraphs(graph, target_graph, basis, plans, converted=converted)
+            cache.put(key, count)
+        return count
+
+    if basis is None:
+        basis = subgraph_basis(graph)
+    if plans is None:
+        plans = {}
+    if converted is None:
+        converted = ConvertedTarget(target_graph)
+
+    total = 0
+    for quotient, coefficient in basis:
+        key = quotient.graph6_string()
+        if key not in plans:
+            plans[key] = PatternPlan(quotient)
+        counter = GraphHomomorphismCounter(plans[key].graph, target_graph, plan=plans[key], converted=converted)
+        total += coefficient * counter.count_homomorphisms()
+
+    return int(total)